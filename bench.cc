@@ -0,0 +1,412 @@
+#include "debug.h"
+#include "config.h"
+#include "threads.h"
+#include "barrier.h"
+#include "pit.h"
+#include "smp.h"
+#include "workers.h"
+#include "queue.h"
+#include "lockfree.h"
+#include "tasks.h"
+#include "parallel.h"
+#include "heap.h"
+#include "machine.h"
+#include "bulk.h"
+#include "speaker.h"
+
+/*
+    Kernel micro-benchmarks. Nothing here is checked against a .ok file,
+    the numbers are printed with a *** prefix so they end up in bench.out
+
+        QEMU_SMP=1 make -s bench.raw && make -s bench.out && cat bench.out
+        QEMU_SMP=16 make -s bench.raw && make -s bench.out && cat bench.out
+*/
+
+// one counter per cache line so the workers don't measure false sharing
+struct alignas(64) Counter {
+    volatile uint32_t n = 0;
+};
+
+// ops * jiffiesPerSecond / jiffies, multiplied out in 64 bits first.
+// There is no libgcc for a 64-bit division, divl does 64 by 32 as long
+// as the answer fits in 32 bits.
+static uint32_t perSecond(uint32_t ops, uint32_t jiffies) {
+    if (jiffies == 0) return 0;
+    uint64_t scaled = uint64_t(ops) * Pit::secondsToJiffies(1);
+    uint32_t hi = uint32_t(scaled >> 32);
+    if (hi >= jiffies) return 0xFFFFFFFF;
+    uint32_t q, r;
+    asm ("divl %4" : "=a"(q), "=d"(r) : "a"(uint32_t(scaled)), "d"(hi), "rm"(jiffies));
+    return q;
+}
+
+/*
+    Context switches per second. We run two yielding threads per core so
+    every core always has something to switch to. With per-core ready
+    queues the per-core rate should stay flat as QEMU_SMP goes up.
+*/
+void contextSwitches(uint32_t seconds) {
+    static Counter counters[2 * MAX_PROCS];
+    const uint32_t nThreads = 2 * kConfig.totalProcs;
+    auto done = new Barrier(nThreads + 1);
+    auto go = new Barrier(nThreads + 1);
+    volatile uint32_t end = 0;
+
+    for (uint32_t i=0; i<nThreads; i++) {
+        thread([i, done, go, &end] {
+            go->sync();
+            while (Pit::jiffies < end) {
+                yield();
+                counters[i].n += 1;
+            }
+            done->sync();
+        });
+    }
+
+    end = Pit::jiffies + Pit::secondsToJiffies(seconds);
+    go->sync();
+    done->sync();
+
+    uint32_t total = 0;
+    for (uint32_t i=0; i<nThreads; i++) total += counters[i].n;
+
+    Debug::printf("*** sched: %d cores, %d threads, %d switches/s, %d switches/s/core\n",
+        kConfig.totalProcs,
+        nThreads,
+        total / seconds,
+        total / seconds / kConfig.totalProcs);
+
+    // the barriers leak, the workers might still be on their way out of sync()
+}
+
+/*
+    Cost of a short background job: a thread per job versus handing the
+    job to a WorkerPool. Both sides do the same trivial work and signal a
+    semaphore when they're done.
+*/
+void spawnCost(uint32_t n) {
+    auto done = new Semaphore(0);
+    auto pool = new WorkerPool(kConfig.totalProcs, 64);
+
+    auto start = Pit::jiffies;
+    for (uint32_t i=0; i<n; i++) {
+        thread([done] { done->up(); });
+    }
+    for (uint32_t i=0; i<n; i++) done->down();
+    auto threadJiffies = Pit::jiffies - start;
+
+    start = Pit::jiffies;
+    for (uint32_t i=0; i<n; i++) {
+        pool->submit([done] { done->up(); });
+    }
+    for (uint32_t i=0; i<n; i++) done->down();
+    auto poolJiffies = Pit::jiffies - start;
+
+    // jobs/s = n / (jiffies / jiffiesPerSecond)
+    auto rate = [n](uint32_t jiffies) {
+        return (jiffies == 0) ? 0 : n * Pit::secondsToJiffies(1) / jiffies;
+    };
+    Debug::printf("*** spawn: %d threads/s, %d pool jobs/s\n", rate(threadJiffies), rate(poolJiffies));
+}
+
+/*
+    Queue contention. The locked Queue against the lock-free ones, with
+    every core hammering the same queue.
+*/
+struct Node {
+    Node* next = nullptr;
+};
+
+constexpr uint32_t NODES_PER_PRODUCER = 8192;
+
+// All but one core produce, the main thread consumes. That is the shape
+// of a per-core inbox.
+template <typename Q>
+uint32_t manyToOne(Q& q, const char* name) {
+    const uint32_t nProducers = (kConfig.totalProcs > 1) ? kConfig.totalProcs - 1 : 1;
+    const uint32_t total = nProducers * NODES_PER_PRODUCER;
+    auto nodes = new Node[total];
+    auto go = new Barrier(nProducers + 1);
+
+    for (uint32_t p=0; p<nProducers; p++) {
+        thread([p, &q, go, nodes] {
+            go->sync();
+            for (uint32_t i=0; i<NODES_PER_PRODUCER; i++) {
+                q.add(&nodes[p * NODES_PER_PRODUCER + i]);
+            }
+        });
+    }
+
+    go->sync();
+    auto start = Pit::jiffies;
+    uint32_t got = 0;
+    while (got < total) {
+        if (q.remove() != nullptr) got ++;
+    }
+    auto jiffies = Pit::jiffies - start;
+    auto rate = perSecond(total, jiffies);
+    Debug::printf("*** mpsc: %s %d producers, %d ops/s\n", name, nProducers, rate);
+
+    // the producers are done with them once we've seen them all
+    delete[] nodes;
+    return rate;
+}
+
+// Every core adds and removes
+template <typename Add, typename Remove>
+uint32_t manyToMany(const char* name, Add add, Remove remove) {
+    constexpr uint32_t ROUNDS = 8192;
+    static Node nodes[MAX_PROCS];
+    const uint32_t n = kConfig.totalProcs;
+    auto go = new Barrier(n + 1);
+    auto done = new Barrier(n + 1);
+
+    for (uint32_t t=0; t<n; t++) {
+        thread([t, go, done, add, remove] {
+            go->sync();
+            // we may get somebody else's node back, that's the one we
+            // add next. Adding one that is still queued would corrupt
+            // the Queue.
+            Node* mine = &nodes[t];
+            for (uint32_t i=0; i<ROUNDS; i++) {
+                add(mine);
+                while ((mine = remove()) == nullptr);
+            }
+            done->sync();
+        });
+    }
+
+    auto start = Pit::jiffies;
+    go->sync();
+    done->sync();
+    auto jiffies = Pit::jiffies - start;
+    auto total = 2 * n * ROUNDS;
+    auto rate = perSecond(total, jiffies);
+    Debug::printf("*** mpmc: %s %d threads, %d ops/s\n", name, n, rate);
+    return rate;
+}
+
+void queueContention() {
+    auto locked = new Queue<Node,InterruptSafeLock>();
+    auto mpsc = new MPSCQueue<Node>();
+    manyToOne(*locked, "Queue");
+    manyToOne(*mpsc, "MPSCQueue");
+
+    auto locked2 = new Queue<Node,InterruptSafeLock>();
+    manyToMany("Queue",
+        [locked2](Node* it) { locked2->add(it); },
+        [locked2] { return locked2->remove(); });
+
+    auto ring = new MPMCRing<Node*,64>();
+    manyToMany("MPMCRing",
+        [ring](Node* it) { while (!ring->try_add(it)); },
+        [ring] { Node* it = nullptr; ring->try_remove(it); return it; });
+}
+
+/*
+    Stackless tasks. n tasks all wait on the same Signal, so they are
+    all in flight at once with no stacks of their own, then each one
+    finishes and checks in.
+*/
+struct Waiter : public Task {
+    Signal* go;
+    Semaphore* done;
+    bool started = false;
+
+    Waiter(Signal* go, Semaphore* done) : go(go), done(done) {}
+
+    Step step() override {
+        if (!started) {
+            started = true;
+            return waitFor(go);
+        }
+        done->up();
+        return Step::Done;
+    }
+};
+
+void taskThroughput(uint32_t n) {
+    auto executor = new Executor(kConfig.totalProcs);
+    auto go = new Signal();
+    auto done = new Semaphore(0);
+
+    auto start = Pit::jiffies;
+    for (uint32_t i=0; i<n; i++) {
+        executor->spawn(new Waiter(go, done));
+    }
+    go->fire();
+    for (uint32_t i=0; i<n; i++) done->down();
+    auto jiffies = Pit::jiffies - start;
+
+    auto rate = perSecond(n, jiffies);
+    Debug::printf("*** tasks: %d in flight, %d tasks/s\n", n, rate);
+}
+
+/*
+    parallel_for speedup. The same CPU-bound loop with 1, 2, 4, 8 and 16
+    workers (as far as QEMU_SMP allows), speedup is printed x100.
+*/
+static uint32_t churn(uint32_t x) {
+    for (uint32_t i=0; i<64; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+    }
+    return x;
+}
+
+void parallelSpeedup(uint32_t n) {
+    static Counter sums[MAX_PROCS];
+    uint32_t oneWorker = 0;
+
+    for (uint32_t workers=1; workers<=MAX_PROCS; workers *= 2) {
+        if (workers > kConfig.totalProcs) break;
+        for (uint32_t i=0; i<MAX_PROCS; i++) sums[i].n = 0;
+
+        auto start = Pit::jiffies;
+        parallel_for(0, n, 1024, [](uint32_t lo, uint32_t hi) {
+            uint32_t sum = 0;
+            for (uint32_t i=lo; i<hi; i++) sum += churn(i + 1);
+            __atomic_add_fetch(&sums[SMP::me()].n, sum, __ATOMIC_RELAXED);
+        }, workers);
+        auto jiffies = Pit::jiffies - start;
+        if (jiffies == 0) jiffies = 1;
+        if (workers == 1) oneWorker = jiffies;
+
+        Debug::printf("*** parallel_for: %d workers, %d jiffies, speedup x100 %d\n",
+            workers, jiffies, oneWorker * 100 / jiffies);
+    }
+}
+
+/*
+    Allocation throughput, the slab in front of malloc against the
+    first-fit heap it falls back to. Every thread keeps a handful of
+    small blocks of mixed sizes live and replaces them one at a time.
+*/
+template <typename Alloc, typename Free>
+void allocRate(const char* name, uint32_t nThreads, Alloc alloc, Free free) {
+    constexpr uint32_t LIVE = 16;
+    constexpr uint32_t ROUNDS = 20000;
+    auto go = new Barrier(nThreads + 1);
+    auto done = new Barrier(nThreads + 1);
+
+    for (uint32_t t=0; t<nThreads; t++) {
+        thread([t, go, done, alloc, free] {
+            void* live[LIVE];
+            uint32_t x = t + 1;
+            for (uint32_t i=0; i<LIVE; i++) live[i] = alloc(8 + (i * 24));
+            go->sync();
+            for (uint32_t i=0; i<ROUNDS; i++) {
+                x ^= x << 13;
+                x ^= x >> 17;
+                x ^= x << 5;
+                auto slot = x % LIVE;
+                free(live[slot]);
+                live[slot] = alloc(8 + (x >> 8) % 504);
+            }
+            for (uint32_t i=0; i<LIVE; i++) free(live[i]);
+            done->sync();
+        });
+    }
+
+    auto start = Pit::jiffies;
+    go->sync();
+    done->sync();
+    auto jiffies = Pit::jiffies - start;
+    auto total = 2 * nThreads * ROUNDS;
+    auto rate = perSecond(total, jiffies);
+    Debug::printf("*** alloc: %s %d threads, %d ops/s\n", name, nThreads, rate);
+}
+
+void allocThroughput() {
+    for (uint32_t n=1; n<=kConfig.totalProcs; n *= 2) {
+        allocRate("malloc", n,
+            [](uint32_t bytes) { return malloc(bytes); },
+            [](void* p) { free(p); });
+        allocRate("first-fit", n,
+            [](uint32_t bytes) { return gheith::firstFitAlloc(bytes); },
+            [](void* p) { gheith::firstFitFree(p); });
+    }
+}
+
+/*
+    Copy and fill cost from 1 byte to 1MB, in cycles per call (rdtsc).
+    Every size moves about 16MB altogether. "bulk" is Bulk::copy, the
+    same as memcpy below Bulk::STREAM_BYTES.
+*/
+template <typename Work>
+uint32_t cyclesPerCall(uint32_t reps, Work work) {
+    auto start = rdtsc();
+    for (uint32_t i=0; i<reps; i++) work();
+    return uint32_t(rdtsc() - start) / reps;
+}
+
+void memoryBandwidth() {
+    constexpr uint32_t MAX = 1 << 20;
+    auto src = new char[MAX];
+    auto dest = new char[MAX];
+    memset(src, 0x5a, MAX);
+
+    for (uint32_t bytes=1; bytes<=MAX; bytes *= 4) {
+        auto reps = (16 * MAX) / bytes;
+        if (reps > 100000) reps = 100000;
+        // keeps the compiler from inlining a copy of a known size
+        volatile uint32_t n = bytes;
+
+        auto copy = cyclesPerCall(reps, [&] { memcpy(dest, src, n); });
+        auto fill = cyclesPerCall(reps, [&] { memset(dest, 0, n); });
+        auto bulk = cyclesPerCall(reps, [&] { Bulk::copy(dest, src, n); });
+        Debug::printf("*** mem: %d bytes, memcpy %d cycles, memset %d cycles, bulk %d cycles\n",
+            bytes, copy, fill, bulk);
+    }
+
+    delete[] src;
+    delete[] dest;
+}
+
+/*
+    PC speaker playback. Half a second of a 440Hz triangle wave at 8KHz
+    goes through Speaker::write in small pieces, then drain() waits for
+    it to play out. Should take about 500ms, the sample clock is the
+    jiffy. A second buffer is cut short with stop().
+*/
+void speakerPlayback() {
+    constexpr uint32_t RATE = 8000;
+    constexpr uint32_t N = RATE / 2;
+    constexpr uint32_t PIECE = 256;
+    auto pcm = new int16_t[N];
+    constexpr uint32_t PERIOD = RATE / 440;
+    for (uint32_t i=0; i<N; i++) {
+        uint32_t phase = i % PERIOD;
+        uint32_t up = (phase < PERIOD / 2) ? phase : PERIOD - phase;
+        pcm[i] = int16_t(int32_t(up * 65535 / (PERIOD / 2)) - 32768);
+    }
+
+    auto start = Pit::jiffies;
+    for (uint32_t i=0; i<N; i+=PIECE) {
+        Speaker::write(pcm + i, (N - i < PIECE) ? N - i : PIECE, RATE);
+    }
+    auto wasPlaying = Speaker::playing();
+    Speaker::drain();
+    auto ms = (Pit::jiffies - start) * 1000 / Pit::secondsToJiffies(1);
+    Debug::printf("*** speaker: %d samples at %dHz in %dms, expected %dms, playing %d stopped %d\n",
+        N, RATE, ms, N * 1000 / RATE, wasPlaying, !Speaker::playing());
+
+    Speaker::write(pcm, N, RATE);
+    Speaker::stop();
+    Debug::printf("*** speaker: stop() with %d queued, playing %d\n", N, Speaker::playing());
+
+    delete[] pcm;
+}
+
+void kernelMain(void) {
+    contextSwitches(2);
+    spawnCost(2000);
+    queueContention();
+    taskThroughput(10000);
+    parallelSpeedup(1 << 20);
+    allocThroughput();
+    memoryBandwidth();
+    speakerPlayback();
+    dumpSchedStats();
+}
@@ -2,15 +2,28 @@
 #include "ext2.h"
 #include "libk.h"
 #include "threads.h"
+#include "config.h"
 #include "semaphore.h"
 #include "future.h"
 #include "pit.h"
+#include "timer.h"
 // #include "list_wave.h"
 #include "vga.h"
 #include "kb.h"
 // #include "names.h"
 
 
+// The refill thread plays "file", the UI loop switches songs. Both hold
+// "lock" while they touch the stream, the UI only when it changes it.
+struct Player {
+    BlockingLock lock;
+    Shared<WaveParser_list> file;
+    uint64_t written = 0;           // where we are in the 64K ring
+    uint32_t index = 0;             // the next of the 16 buffers to refill
+    bool playing = false;
+    volatile bool finished = false; // the song ran out, the UI moves on
+};
+
 // this function is used to get the response from the register after givinf it all the information in the set command 
 // function
 uint32_t get_response(char *base) {
@@ -254,15 +267,13 @@ void turnOnDevice(uint32_t *base_u) {
     
     while(*(base_u + 2) == 0) {
         Debug::printf("It's not on Yet, %x\n", *(base_u + 2));
+        sleep_ms(1);
     }
 
     Debug::printf("DEVICE IS TURNED ON: %x\n", (*(base_u + 2)));
 
-    volatile uint32_t help = 0; 
-
-    while(help  < 10000) {
-        help += 1; 
-    }
+    // the codecs need 521us after CRST before they talk to us
+    sleep_ms(1);
 }
 
 /*
@@ -379,8 +390,6 @@ void kernelMain(void) {
 
    // DPLBASE ~ Sanity Check ~ FAIL ~ RIP ~ WE ARE INSANE
     // uint64_t offset = 4096;
-    uint64_t written = 0; 
-    uint32_t index = 0; 
     // uint32_t size = currentFile->size_of_the_whole_file;
 
     Shared<WaveParser_list>* my_wave = &(currentFile);
@@ -407,6 +416,7 @@ void kernelMain(void) {
             uint32_t percentage = ((*my_wave)->howMuchRead.get() * 100) / (*my_wave)->size;
             // Debug::printf("percentage: %d, read in: %d, size: %d\n", percentage, (*my_wave)->howMuchRead.get(), (*my_wave)->size);
             thisVGA->playingSong(percentage);
+            sleep_ms(5);
         }
     });
 
@@ -414,34 +424,92 @@ void kernelMain(void) {
     while(thisKB->tapped) {
         Debug::printf("WTF Man\n");
     }
-    
-    while(true) {
-        /* 
-            makes sure the hardware and software are in sync and there are no race condition
-        */
-        volatile uint32_t hardware_offset = *(volatile uint32_t*) (base_addy_plus_x + 0x4);
-        if (((hardware_offset - written) % 65536) > 4096) {
-            currentFile->howMuchRead.fetch_add(4096); 
-            currentFile->rebuildData(index++);
-            written += 4096;
-            written %= 65536;
-            index %= 16; 
+
+    auto player = new Player();
+    player->file = currentFile;
+    player->playing = true;
+
+    // stops the stream and rewinds the song it was playing
+    auto stop = [player] {
+        char * SDnCTL = (char *) 0xfebf0000 + (0x80 + 4 * 0x20);
+        LockGuard g{player->lock};
+        *((uint32_t*)SDnCTL) = (*((uint32_t*)SDnCTL) & (0xFFFFFFFD));
+        player->playing = false;
+        player->written = 0; 
+        player->index = 0; 
+        player->file->offset = player->file->reset_offset;
+        player->file->howMuchRead.set(0);
+    };
+
+    // the refill thread plays f from the start
+    auto play = [player](Shared<WaveParser_list> f) {
+        LockGuard g{player->lock};
+        player->file = f;
+        player->written = 0; 
+        player->index = 0; 
+        f->offset = f->reset_offset;
+        f->howMuchRead.set(0);
+        reset(f);
+        player->finished = false;
+        player->playing = true;
+    };
+
+    thread([player, base_addy_plus_x] {
+        // Refilling the buffers is the one thing that can't be late. Give
+        // it the last core to itself so it never shares its caches with the
+        // UI, which stays on this thread. With a single core we settle for
+        // RealTime, we sleep whenever nothing is due so this doesn't starve
+        // anybody.
+        if (!reserveCore(kConfig.totalProcs - 1)) {
+            setPriority(Priority::RealTime);
         }
+        char * SDnCTL = (base_addy_plus_x);
+
+        while(true) {
+            bool refilled = false;
+            {
+                LockGuard g{player->lock};
+                auto currentFile = player->file;
+
+                /* 
+                    makes sure the hardware and software are in sync and there are no race condition
+                */
+                volatile uint32_t hardware_offset = *(volatile uint32_t*) (base_addy_plus_x + 0x4);
+                if (player->playing && ((hardware_offset - player->written) % 65536) > 4096) {
+                    refilled = true;
+                    currentFile->howMuchRead.fetch_add(4096); 
+                    currentFile->rebuildData(player->index++);
+                    player->written += 4096;
+                    player->written %= 65536;
+                    player->index %= 16; 
+                }
+
+                // Done with the song, the UI picks the next one
+                if(player->playing && currentFile->howMuchRead.get() >= currentFile->size) {
+                    // Turn Off Sound 
+                    *((uint32_t*)SDnCTL) = (*((uint32_t*)SDnCTL) & (0xFFFFFFFD));
+                    player->playing = false;
+                    player->finished = true;
+                }
+            }
 
-        // Done with the song
-        if(currentFile->howMuchRead.get() >= currentFile->size) {
-        
-            // Turn Off Sound 
-            *((uint32_t*)SDnCTL) = (*((uint32_t*)SDnCTL) & (0xFFFFFFFD));
+            // a period is ~23ms at 44.1kHz, checking every ms is plenty
+            if (!refilled) {
+                sleep_ms(1);
+            }
+        }
+    });
+
+    while(true) {
+
+        // Done with the song or Next Song
+        if(player->finished || thisKB->skip) {
+            thisKB->skip = false; 
 
-            // Reset Offsets 
-            written = 0; 
-            index = 0; 
-            currentFile->offset = currentFile->reset_offset;
-            currentFile->howMuchRead.set(0);
+            stop();
             thisVGA->new_song = true; 
             thisVGA->elapsed_time.set(0); 
-            
+
             /* VGA Animation */
             thisVGA->spotify_move(currentNode, true, false);
 
@@ -454,17 +522,17 @@ void kernelMain(void) {
             }
             currentFile = currentNode->wave_file;
 
-            // after the song is done playing it restarts the song again
-            reset(currentFile);
-
-            Debug::printf("Should be Reset\n");
+            play(currentFile);
         }
 
         // Space Bar
         if(thisKB->tapped) {
 
             // Change playing mode if playing then pause and if paused then plays
-            flipBit();
+            {
+                LockGuard g{player->lock};
+                flipBit();
+            }
             thisKB->tapped = false; 
 
             // VGA 
@@ -475,16 +543,10 @@ void kernelMain(void) {
         if(thisKB->reset) {
             thisKB->reset = false; 
 
-            // Reset Offset 
-            currentFile->offset = currentFile->reset_offset;
-            written = 0; 
-            index = 0; 
-
-            // Reset Buffer 
-            reset(currentFile);
+            // Reset Offset and Buffer
+            play(currentFile);
 
             // VGA Reset
-            currentFile->howMuchRead.set(0);
             thisVGA->new_song = true; 
             thisVGA->elapsed_time.set(0); 
 
@@ -495,14 +557,7 @@ void kernelMain(void) {
         if(thisKB->precend) {
             thisKB->precend = false; 
 
-            // Turn Off Sound 
-            *((uint32_t*)SDnCTL) = (*((uint32_t*)SDnCTL) & (0xFFFFFFFD));
-
-            // Reset Offsets 
-            written = 0; 
-            index = 0; 
-            currentFile->offset = currentFile->reset_offset;
-            currentFile->howMuchRead.set(0);
+            stop();
             thisVGA->new_song = true; 
             thisVGA->elapsed_time.set(0); 
 
@@ -519,39 +574,8 @@ void kernelMain(void) {
 
             currentFile = currentNode->wave_file;
 
-            reset(currentFile);
-
-        }
-
-        // Next Song
-        if(thisKB->skip) {
-            thisKB->skip = false; 
-
-            // Turn Off Sound 
-            *((uint32_t*)SDnCTL) = (*((uint32_t*)SDnCTL) & (0xFFFFFFFD));
-
-            // Reset Offsets 
-            written = 0; 
-            index = 0; 
-            currentFile->offset = currentFile->reset_offset;
-            currentFile->howMuchRead.set(0);
-            thisVGA->new_song = true; 
-            thisVGA->elapsed_time.set(0); 
-
-            /* VGA Animation */
-            thisVGA->spotify_move(currentNode, true, false);
-
-            // Changes File 
-            currentNode = currentNode->next; 
-
-            // skip the dummy node
-            if(K::streq(currentNode->file_name, "")) {
-                currentNode = currentNode->next;
-            }
-            currentFile = currentNode->wave_file;
-
+            play(currentFile);
 
-            reset(currentFile);
         }
 
         // Enter ~ search song 
@@ -563,25 +587,18 @@ void kernelMain(void) {
 
             if(!K::streq(temp->file_name, "")) {
 
-                // Turn Off Sound 
-                *((uint32_t*)SDnCTL) = (*((uint32_t*)SDnCTL) & (0xFFFFFFFD));
+                stop();
 
                 currentNode = temp; 
                 currentFile = currentNode->wave_file;
 
-
-                // Reset Offsets 
-                written = 0; 
-                index = 0; 
-                currentFile->offset = currentFile->reset_offset;
-                currentFile->howMuchRead.set(0);
                 thisVGA->new_song = true; 
                 thisVGA->elapsed_time.set(0); 
 
                 /* VGA Animation */
                 thisVGA->spotify(currentNode, true);
 
-                reset(currentFile);
+                play(currentFile);
             } else {
                 thisVGA->drawRectangle(70, 9, 250, 19, 63, 1); // text box
                 thisVGA->drawString(96, 10, (const char*)"NOT A VALID SONG", 48); // enter spotify
@@ -592,7 +609,7 @@ void kernelMain(void) {
         // Shutoff Screen 
         if(thisKB->shutdown) {
             // Turn Off Sound 
-            *((uint32_t*)SDnCTL) = (*((uint32_t*)SDnCTL) & (0xFFFFFFFD));
+            stop();
 
             thisKB->shutdown = false; 
             isItDown = true; 
@@ -600,6 +617,9 @@ void kernelMain(void) {
             
         }
 
+        // key presses can wait a few ms
+        sleep_ms(5);
+
    }
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,57 @@
+#include "arena.h"
+#include "heap.h"
+#include "debug.h"
+#include "threads.h"
+
+void* Arena::grow(uint32_t bytes, uint32_t align) {
+    auto need = bytes + align;
+    if (spare != nullptr && spare->size >= need) {
+        auto c = spare;
+        spare = nullptr;
+        c->prev = chunk;
+        chunk = c;
+    } else {
+        auto size = (need > chunkBytes) ? need : chunkBytes;
+        auto c = (Chunk*) malloc(sizeof(Chunk) + size);
+        if (c == nullptr) Debug::panic("out of memory");
+        c->prev = chunk;
+        c->size = size;
+        chunk = c;
+    }
+    used = 0;
+    return alloc(bytes, align);
+}
+
+void Arena::recycle(Chunk* c) {
+    if (spare == nullptr) {
+        spare = c;
+    } else if (c->size > spare->size) {
+        free(spare);
+        spare = c;
+    } else {
+        free(c);
+    }
+}
+
+void Arena::release(Mark m) {
+    while (chunk != m.chunk) {
+        ASSERT(chunk != nullptr);
+        auto c = chunk;
+        chunk = c->prev;
+        recycle(c);
+    }
+    used = m.used;
+}
+
+Arena::~Arena() {
+    reset();
+    if (spare != nullptr) free(spare);
+}
+
+Arena& scratchArena() {
+    auto me = gheith::current();
+    if (me->scratch == nullptr) {
+        me->scratch = new Arena();
+    }
+    return *me->scratch;
+}
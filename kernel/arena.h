@@ -0,0 +1,101 @@
+#ifndef _arena_h_
+#define _arena_h_
+
+#include "stdint.h"
+
+// Bump-pointer allocation for short-lived buffers. alloc() is a handful
+// of instructions and nothing is freed one at a time: release() gives
+// back everything allocated after a mark, reset() everything. Memory
+// comes from malloc in chunks. Of the chunks a release lets go, the
+// biggest one is kept for next time, so a path that needs the same
+// buffers over and over only goes to the heap the first time.
+//
+// Only for things that don't need a destructor (buffers, PODs).
+//
+//     {
+//         ArenaScope scratch;                  // the calling thread's arena
+//         auto header = scratch.alloc<char>(14);
+//         ...
+//     }                                        // header is gone
+//
+class Arena {
+    struct Chunk {
+        Chunk* prev;
+        uint32_t size;          // bytes after the header
+    };
+
+    Chunk* chunk = nullptr;     // the one we bump in
+    uint32_t used = 0;
+    Chunk* spare = nullptr;
+    const uint32_t chunkBytes;
+
+    static inline uintptr_t base(Chunk* c) {
+        return uintptr_t(c + 1);
+    }
+
+    void* grow(uint32_t bytes, uint32_t align);
+    void recycle(Chunk* c);
+
+public:
+    struct Mark {
+        Chunk* chunk;
+        uint32_t used;
+    };
+
+    explicit Arena(uint32_t chunkBytes = 4096) : chunkBytes(chunkBytes) {}
+    Arena(const Arena&) = delete;
+    ~Arena();
+
+    // align is a power of 2
+    inline void* alloc(uint32_t bytes, uint32_t align = 8) {
+        if (chunk != nullptr) {
+            auto at = ((base(chunk) + used + align - 1) & ~uintptr_t(align - 1)) - base(chunk);
+            if (at + bytes <= chunk->size) {
+                used = at + bytes;
+                return (void*) (base(chunk) + at);
+            }
+        }
+        return grow(bytes, align);
+    }
+
+    template <typename T>
+    inline T* alloc(uint32_t n) {
+        return (T*) alloc(n * sizeof(T), alignof(T));
+    }
+
+    inline Mark mark() const {
+        return Mark{chunk, used};
+    }
+
+    // everything allocated since m was taken goes away
+    void release(Mark m);
+
+    inline void reset() {
+        release(Mark{nullptr, 0});
+    }
+};
+
+// The calling thread's own arena, it goes away with the thread
+extern Arena& scratchArena();
+
+// Releases what was allocated in it when it goes out of scope. Scopes on
+// the same arena have to nest.
+class ArenaScope {
+    Arena& arena;
+    const Arena::Mark start;
+public:
+    ArenaScope() : ArenaScope(scratchArena()) {}
+    explicit ArenaScope(Arena& arena) : arena(arena), start(arena.mark()) {}
+    ArenaScope(const ArenaScope&) = delete;
+
+    ~ArenaScope() {
+        arena.release(start);
+    }
+
+    template <typename T>
+    inline T* alloc(uint32_t n) {
+        return arena.alloc<T>(n);
+    }
+};
+
+#endif
@@ -13,3 +13,26 @@ void pause() {
 
 
 
+
+LockStats* volatile LockStats::all = nullptr;
+
+LockStats::LockStats(const char* name, int32_t id) : name(name), id(id) {
+    auto old = __atomic_load_n(&all,__ATOMIC_RELAXED);
+    do {
+        nextStats = old;
+    } while (!__atomic_compare_exchange_n(&all,&old,this,true,__ATOMIC_RELEASE,__ATOMIC_RELAXED));
+}
+
+void LockStats::dump() {
+    Debug::printf("| locks: name acquisitions contended spins maxHold(cycles)\n");
+    for (auto it = __atomic_load_n(&all,__ATOMIC_ACQUIRE); it != nullptr; it = it->nextStats) {
+        if (it->acquisitions == 0) continue;
+        if (it->id < 0) {
+            Debug::printf("| locks: %s %u %u %u %u\n",
+                it->name, it->acquisitions, it->contended, it->spins, it->maxHold);
+        } else {
+            Debug::printf("| locks: %s[%d] %u %u %u %u\n",
+                it->name, it->id, it->acquisitions, it->contended, it->spins, it->maxHold);
+        }
+    }
+}
@@ -55,6 +55,16 @@ public:
     T add_fetch(T inc) {
         return __atomic_add_fetch(&value,inc,__ATOMIC_SEQ_CST);
     }
+    // true if it was "expected" and is now "desired"
+    bool compare_exchange(T expected, T desired) {
+        return __atomic_compare_exchange_n(&value,&expected,desired,false,__ATOMIC_SEQ_CST,__ATOMIC_SEQ_CST);
+    }
+    T fetch_or(T bits) {
+        return __atomic_fetch_or(&value,bits,__ATOMIC_SEQ_CST);
+    }
+    T fetch_and(T bits) {
+        return __atomic_fetch_and(&value,bits,__ATOMIC_SEQ_CST);
+    }
     void set(T inc) {
         return __atomic_store_n(&value,inc,__ATOMIC_SEQ_CST);
     }
@@ -85,6 +95,20 @@ public:
     Atomic(int64_t) = delete;
 };
 
+// How long each core keeps interrupts disabled, built with -DIRQ_STATS.
+// Covers Interrupts::disable/restore and the interrupt handlers that
+// go through Softirq (see softirq.h). Defined in softirq.cc
+class IrqStats {
+public:
+    // stretches longer than this get counted
+    static constexpr uint32_t LIMIT = 100000;
+
+    static void start();            // once SMP::me() works
+    static void off();
+    static void on(const void* site);
+    static void dump();
+};
+
 class Interrupts {
 public:
     static bool isDisabled() {
@@ -94,13 +118,20 @@ public:
 
     static bool disable() {
         bool wasDisabled = isDisabled();
-        if (!wasDisabled)
+        if (!wasDisabled) {
             cli();
+#ifdef IRQ_STATS
+            IrqStats::off();
+#endif
+        }
         return wasDisabled;
     }
 
     static void restore(bool wasDisabled) {
         if (!wasDisabled) {
+#ifdef IRQ_STATS
+            IrqStats::on(__builtin_return_address(0));
+#endif
             sti();
         }
     }
@@ -244,7 +275,117 @@ public:
     }
 };
 
+// Counters for one lock: how often it was taken, how often somebody had
+// to wait for it, how long they spun and the longest it was held (in TSC
+// cycles). Only the holder updates them. Every LockStats registers
+// itself and dump() prints them all over serial.
+class LockStats {
+    static LockStats* volatile all;
+    LockStats* nextStats = nullptr;
+    uint64_t heldSince = 0;
+public:
+    const char* const name;
+    const int32_t id;
+    uint32_t acquisitions = 0;
+    uint32_t contended = 0;
+    uint32_t spins = 0;
+    uint32_t maxHold = 0;
+
+    LockStats(const char* name, int32_t id = -1);
+    LockStats(const LockStats&) = delete;
+
+    inline void acquired(uint32_t spun) {
+        acquisitions ++;
+        if (spun != 0) {
+            contended ++;
+            spins += spun;
+        }
+        heldSince = rdtsc();
+    }
+
+    inline void released() {
+        auto held = rdtsc() - heldSince;
+        if (held > maxHold) maxHold = (held >> 32) ? 0xffffffff : uint32_t(held);
+    }
+
+    static void dump();
+};
+
+// A ticket lock. Unlike SpinLock, waiters get the lock in the order
+// they asked for it, and they only read the line while they wait, they
+// back off in proportion to how many are ahead of them.
+class TicketLock {
+    volatile uint32_t nextTicket = 0;
+    volatile uint32_t serving = 0;
+    LockStats* stats = nullptr;
+public:
+    TicketLock() {}
+    TicketLock(const TicketLock&) = delete;
+
+    // Start counting into s. Does nothing unless built with -DLOCK_STATS
+    void track(LockStats* s) {
+#ifdef LOCK_STATS
+        stats = s;
+#else
+        (void) s;
+#endif
+    }
+
+    // for debugging, etc. Allows false positives
+    bool isMine() {
+        return serving != nextTicket;
+    }
+
+    void lock() {
+        auto mine = __atomic_fetch_add(&nextTicket,1,__ATOMIC_RELAXED);
+        uint32_t spun = 0;
+        while (true) {
+            auto now = __atomic_load_n(&serving,__ATOMIC_ACQUIRE);
+            if (now == mine) break;
+            for (uint32_t i=mine-now; i>0; i--) {
+                iAmStuckInALoop(false);
+            }
+            spun ++;
+        }
+        if (stats != nullptr) stats->acquired(spun);
+    }
+
+    void unlock() {
+        if (stats != nullptr) stats->released();
+        __atomic_store_n(&serving,serving+1,__ATOMIC_RELEASE);
+    }
+};
+
+// TicketLock with interrupts disabled while it's held, like
+// InterruptSafeLock. A waiter can't enable interrupts while it spins:
+// once it has a ticket, an interrupt handler on the same core that wants
+// the lock would wait behind it forever.
+class InterruptSafeTicketLock {
+    TicketLock it;
+    volatile bool was = false;
+public:
+    InterruptSafeTicketLock() : it() {}
+    InterruptSafeTicketLock(const InterruptSafeTicketLock&) = delete;
+
+    void track(LockStats* s) {
+        it.track(s);
+    }
+
+    bool isMine() {
+        return it.isMine();
+    }
 
+    void lock() {
+        auto wasDisabled = Interrupts::disable();
+        it.lock();
+        was = wasDisabled;
+    }
 
+    void unlock() {
+        auto wasDisabled = was;
+        it.unlock();
+        Interrupts::restore(wasDisabled);
+    }
+};
 
 #endif
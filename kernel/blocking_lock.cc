@@ -1,2 +1,59 @@
 #include "blocking_lock.h"
+#include "config.h"
 
+// Is t on a core right now?
+static bool running(gheith::TCB* t) {
+    if (t == nullptr) return false;
+    for (uint32_t i=0; i<kConfig.totalProcs; i++) {
+        if (gheith::activeThreads[i] == t) return true;
+    }
+    return false;
+}
+
+void BlockingLock::lockSlow() {
+    using namespace gheith;
+
+    // Spin while it looks like the owner will be done soon
+    for (uint32_t i=0; i<MAX_SPINS; i++) {
+        if (!taken.get() && !taken.exchange(true)) {
+            owner = self();
+            return;
+        }
+        if (!running(owner)) break;
+        pause();
+    }
+
+    // Park
+    auto was = guard.lock();
+    if (!taken.exchange(true)) {
+        guard.unlock(was);
+        owner = self();
+        return;
+    }
+
+    block(BlockOption::MustBlock,[this](TCB* me) {
+        ASSERT(!me->isIdle);
+        waiting.add(me);
+        guard.unlock(true); // the block contract requires interrupts to stay disabled
+    });
+
+    // unlock() handed it to us, owner is already set
+    if (was) cli(); else sti();
+}
+
+void BlockingLock::unlock() {
+    auto was = guard.lock();
+    auto next = waiting.remove();
+    if (next == nullptr) {
+        owner = nullptr;
+        taken.set(false);
+    } else {
+        // stays taken, it's next's now
+        owner = next;
+    }
+    guard.unlock(was);
+
+    if (next != nullptr) {
+        gheith::schedule(next);
+    }
+}
@@ -1,16 +1,62 @@
 #ifndef _blocking_lock_h_
 #define _blocking_lock_h_
 
-#include "semaphore.h"
 #include "atomic.h"
+#include "queue.h"
+#include "threads.h"
+#include "smp.h"
+
+// A mutex for code that can block while holding it.
+//
+// Most critical sections are short (the heap, the ext2 caches) and a
+// context switch costs a lot more than they do. So a thread that finds
+// the lock taken spins for a little while as long as the owner is
+// running on another core, and only parks itself when the owner is
+// descheduled or takes too long. unlock() hands the lock directly to the
+// highest priority parked waiter, so waiters can't be starved by spinners.
+class BlockingLock {
+    // how many times we check before parking, a few microseconds
+    static constexpr uint32_t MAX_SPINS = 1000;
+
+    Atomic<bool> taken;
+    gheith::TCB* volatile owner;    // only a hint for the spinners
+    ISL guard;                      // for waiting and the hand-off
+    // highest priority waiter gets the lock first
+    PriorityQueue<gheith::TCB,NoLock,Priority::COUNT> waiting;
+
+    static gheith::TCB* self() {
+        // The heap lock gets used before there are threads, and by
+        // threadsInit before SMP::init, when current() can't tell cores apart
+        return (!SMP::started || gheith::activeThreads == nullptr) ? nullptr : gheith::current();
+    }
+
+    void lockSlow();
 
-class BlockingLock : public Semaphore {
 public:
-    inline BlockingLock() : Semaphore(1) {}
+    Atomic<uint32_t> ref_count;
+
+    BlockingLock() : taken(false), owner(nullptr), guard(), waiting(), ref_count(0) {}
+    BlockingLock(const BlockingLock&) = delete;
+
+    inline void lock() {
+        if (!taken.exchange(true)) {
+            owner = self();
+            return;
+        }
+        lockSlow();
+    }
+
+    void unlock();
+
+    // without waiting, false if somebody has it
+    inline bool try_lock() {
+        if (taken.exchange(true)) return false;
+        owner = self();
+        return true;
+    }
 
-    inline void lock() { down(); }
-    inline void unlock() { up(); }
-    inline bool isMine() { return true; }
+    // for debugging, etc. Allows false positives
+    inline bool isMine() { return taken.get(); }
 };
 
 
@@ -0,0 +1,19 @@
+#include "bulk.h"
+#include "fpu.h"
+#include "machine.h"
+
+void Bulk::copy(void* dest, const void* src, size_t n) {
+    if ((n >= STREAM_BYTES) && Fpu::sse2()) {
+        streamCopy(dest, src, n);
+    } else {
+        memcpy(dest, src, n);
+    }
+}
+
+void Bulk::zero(void* dest, size_t n) {
+    if ((n >= STREAM_BYTES) && Fpu::sse2()) {
+        streamZero(dest, n);
+    } else {
+        bzero(dest, n);
+    }
+}
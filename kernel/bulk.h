@@ -0,0 +1,28 @@
+#ifndef _bulk_h_
+#define _bulk_h_
+
+#include "stdint.h"
+
+// Copies and fills too big for the caches to help.
+//
+// memcpy, memset and bzero (extra.S) use rep movsd/stosd and leave
+// everything they touch in the cache. For a whole track or a screenful
+// of pixels that just pushes out what everybody else was using. From
+// STREAM_BYTES up, and if CPUID said the CPU has SSE2 (Fpu::sse2),
+// these write with non-temporal stores that go around the caches.
+// Anything smaller, or no SSE2, is plain memcpy/bzero.
+//
+// Threads only, the stores go through XMM registers (see fpu.h).
+class Bulk {
+    // bulk_simd.cc
+    static void streamCopy(void* dest, const void* src, size_t n);
+    static void streamZero(void* dest, size_t n);
+
+public:
+    static constexpr uint32_t STREAM_BYTES = 64 * 1024;
+
+    static void copy(void* dest, const void* src, size_t n);
+    static void zero(void* dest, size_t n);
+};
+
+#endif
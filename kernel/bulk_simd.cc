@@ -0,0 +1,58 @@
+#include "bulk.h"
+#include "machine.h"
+
+// Built with -msse2. MOVNTDQ wants dest 16 byte aligned, the bytes
+// before that and the ones after the last whole 64 go through memcpy.
+
+typedef long long v2di __attribute__((vector_size(16)));
+
+static inline uint32_t headBytes(void* dest, size_t n) {
+    uint32_t head = (16 - (uintptr_t(dest) & 15)) & 15;
+    return (head > n) ? n : head;
+}
+
+void Bulk::streamCopy(void* dest, const void* src, size_t n) {
+    auto d = (char*) dest;
+    auto s = (const char*) src;
+
+    auto head = headBytes(d, n);
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    for (; n >= 64; n -= 64, d += 64, s += 64) {
+        auto a = (v2di) __builtin_ia32_loaddqu(s);
+        auto b = (v2di) __builtin_ia32_loaddqu(s + 16);
+        auto c = (v2di) __builtin_ia32_loaddqu(s + 32);
+        auto e = (v2di) __builtin_ia32_loaddqu(s + 48);
+        __builtin_ia32_movntdq((v2di*) d, a);
+        __builtin_ia32_movntdq((v2di*) (d + 16), b);
+        __builtin_ia32_movntdq((v2di*) (d + 32), c);
+        __builtin_ia32_movntdq((v2di*) (d + 48), e);
+    }
+    // the streaming stores aren't ordered with anything else
+    __builtin_ia32_sfence();
+
+    memcpy(d, s, n);
+}
+
+void Bulk::streamZero(void* dest, size_t n) {
+    auto d = (char*) dest;
+
+    auto head = headBytes(d, n);
+    bzero(d, head);
+    d += head;
+    n -= head;
+
+    v2di z = {0, 0};
+    for (; n >= 64; n -= 64, d += 64) {
+        __builtin_ia32_movntdq((v2di*) d, z);
+        __builtin_ia32_movntdq((v2di*) (d + 16), z);
+        __builtin_ia32_movntdq((v2di*) (d + 32), z);
+        __builtin_ia32_movntdq((v2di*) (d + 48), z);
+    }
+    __builtin_ia32_sfence();
+
+    bzero(d, n);
+}
@@ -5,6 +5,8 @@
 #include "config.h"
 #include "kernel.h"
 #include "atomic.h"
+#include "heap.h"
+#include "shared.h"
 
 OutputStream<char> *Debug::sink = 0;
 bool Debug::debugAll = false;
@@ -40,6 +42,18 @@ void Debug::shutdown() {
             printf("*** passed %d checks\n",checks.get());
         }
     }
+#ifdef LOCK_STATS
+    LockStats::dump();
+#endif
+#ifdef IRQ_STATS
+    IrqStats::dump();
+#endif
+#ifdef HEAP_STATS
+    heapReport();
+#endif
+#ifdef REF_STATS
+    RefStats::dump();
+#endif
     printf("shutdown\n",SMP::me());
     shutdown_called = true;
     while (true) {
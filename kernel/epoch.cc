@@ -0,0 +1,105 @@
+#include "epoch.h"
+#include "smp.h"
+#include "config.h"
+#include "threads.h"
+
+/*
+ * Readers pin the current epoch by bumping a counter for its parity on
+ * their core. A retired object goes on the list for the epoch it was
+ * retired in. Moving from epoch e to e+1 requires that nobody is still
+ * pinned to e-1 (same parity as e+1), and at that point whatever was
+ * retired in e-1 can go: it was unlinked before e started, so only e-1
+ * readers could have seen it.
+ */
+
+namespace gheith {
+
+    struct alignas(64) Readers {
+        volatile uint32_t n[2];
+    };
+
+    static PerCPU<Readers> readers{};
+
+    using Retired = Epoch::Retired;
+
+    static Atomic<uint32_t> epoch{0};
+    static Retired* limbo[2] = { nullptr, nullptr };
+    static InterruptSafeLock limboLock{};
+
+    static void reclaim(Retired* it) {
+        while (it != nullptr) {
+            auto next = it->next;
+            // if it's inside *p it's gone after this
+            auto inside = it->inside;
+            it->reclaim(it->p);
+            if (!inside) delete it;
+            it = next;
+        }
+    }
+}
+
+volatile uint32_t* Epoch::enter() {
+    using namespace gheith;
+    while (true) {
+        auto e = epoch.get();
+        // A stale core is fine, we decrement the one we incremented
+        auto counter = &readers.mine().n[e & 1];
+        __atomic_add_fetch(counter,1,__ATOMIC_SEQ_CST);
+        // if it moved on we could be counting under a parity that is
+        // being checked right now, try again
+        if (epoch.get() == e) return counter;
+        __atomic_sub_fetch(counter,1,__ATOMIC_SEQ_CST);
+    }
+}
+
+void Epoch::leave(volatile uint32_t* counter) {
+    __atomic_sub_fetch(counter,1,__ATOMIC_SEQ_CST);
+}
+
+bool Epoch::advance() {
+    using namespace gheith;
+    Retired* done;
+    {
+        LockGuard g{limboLock};
+        auto e = epoch.get();
+        auto old = (e + 1) & 1;
+        for (uint32_t i=0; i<kConfig.totalProcs; i++) {
+            if (readers.forCPU(i).n[old] != 0) return false;
+        }
+        done = limbo[old];
+        limbo[old] = nullptr;
+        epoch.set(e + 1);
+    }
+    // the destructors can block, do it without the lock
+    reclaim(done);
+    return true;
+}
+
+void Epoch::defer(void* p, void (*fn)(void*)) {
+    queue(new Retired{nullptr, p, fn, false});
+}
+
+void Epoch::queue(Retired* it) {
+    using namespace gheith;
+    {
+        LockGuard g{limboLock};
+        auto slot = epoch.get() & 1;
+        it->next = limbo[slot];
+        limbo[slot] = it;
+    }
+    advance();
+}
+
+bool Epoch::collect() {
+    // whatever was retired in e is freed by the move from e+1 to e+2
+    return advance() && advance();
+}
+
+void Epoch::synchronize() {
+    using namespace gheith;
+    auto start = epoch.get();
+    while ((epoch.get() - start) < 2) {
+        // a reader holding us up may have a lower priority than us
+        if (!advance()) yieldToAll();
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef _epoch_h_
+#define _epoch_h_
+
+#include "stdint.h"
+#include "atomic.h"
+
+// Epoch based reclamation, for read-mostly structures that readers walk
+// without taking a lock:
+//
+//     {
+//         Epoch::Guard g;          // read-side critical section
+//         ... follow pointers ...
+//     }
+//
+// A writer (still serialized by a lock of its own) first unlinks an
+// object and then retires it. It gets deleted once every reader that
+// might have seen it has left its Guard. Readers may block or migrate
+// inside a Guard, but nothing retired meanwhile is freed until they
+// leave, so keep it short.
+class Epoch {
+public:
+    // What retire() keeps about an object until it's freed
+    struct Retired {
+        Retired* next;
+        void* p;
+        void (*reclaim)(void*);
+        bool inside;            // part of *p, not allocated by retire()
+    };
+
+private:
+    static volatile uint32_t* enter();
+    static void leave(volatile uint32_t* counter);
+    static void defer(void* p, void (*reclaim)(void*));
+    static void queue(Retired* it);
+
+public:
+    class Guard {
+        volatile uint32_t* const counter;
+    public:
+        Guard() : counter(enter()) {}
+        Guard(const Guard&) = delete;
+        ~Guard() { leave(counter); }
+    };
+
+    // delete p once it's safe
+    template <typename T>
+    static void retire(T* p) {
+        defer(p, [](void* p) { delete (T*) p; });
+    }
+
+    // Same, but the bookkeeping goes in "in", a member of *p, so this
+    // never allocates. For memory pressure shrinkers (pressure.h).
+    template <typename T>
+    static void retire(T* p, Retired& in) {
+        in = Retired{nullptr, p, [](void* p) { delete (T*) p; }, true};
+        queue(&in);
+    }
+
+    // Tries to free what is safe to free without waiting, retire() does
+    // this on its own. Returns false if readers are in the way.
+    static bool advance();
+
+    // Like synchronize() but gives up instead of waiting for readers.
+    // True if everything retired before the call has been freed.
+    static bool collect();
+
+    // Waits until everything retired before the call has been freed.
+    // Can't be called inside a Guard.
+    static void synchronize();
+};
+
+#endif
@@ -43,7 +43,7 @@ Ext2::Ext2(Shared<Ide> ide) {
 
 }
 
-Shared<Node> Ext2::find(Shared<Node> dir, const char* name) {
+Shared<Node> Ext2::find(Borrowed<Node> dir, const char* name) {
 
     if(!dir->is_dir()) {
         Debug::printf("non find calling firect\n");
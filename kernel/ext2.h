@@ -7,6 +7,10 @@
 #include "shared.h"
 #include "libk.h"
 #include "blocking_lock.h"
+#include "rwlock.h"
+#include "epoch.h"
+#include "arena.h"
+#include "pressure.h"
 
 
 
@@ -126,18 +130,26 @@ struct block_data_meta {
     }
 };
 
-class Cache_Block {
+// Hits only take the read side of "rw" so lookups from different
+// threads run in parallel. A miss reads the block without holding
+// anything and takes the write side just to install it.
+//
+// A Shrinker: it counts against the cache budget, and when it has to
+// give memory back it drops the blocks that were hit the least.
+class Cache_Block : public Shrinker {
 
 public:
 
     block_data_meta *** my_cache; 
     uint32_t size_of_inner_array; 
+    uint32_t rows_e;
     uint32_t bs;
-    BlockingLock * bl; 
+    RWLock * rw; 
+    volatile uint32_t held = 0;         // bytes of blocks, under the write side of rw
     
 
-    Cache_Block(uint32_t rows, uint32_t columns, uint32_t block_size) {
-        bl = new BlockingLock();
+    Cache_Block(uint32_t rows, uint32_t columns, uint32_t block_size) : Shrinker("ext2 blocks") {
+        rw = new RWLock();
         my_cache = new block_data_meta**[rows];
         for(uint32_t x = 0; x < rows; x++) {
             my_cache[x] = new block_data_meta*[columns / (block_size / 1024)];
@@ -148,16 +160,79 @@ public:
         bs = block_size;
 
         size_of_inner_array = (columns / (block_size / 1024)); 
+        rows_e = rows;
 
+        Pressure::add(this);
     }
 
-    void getValue(uint32_t indexc, char* buffer, Shared<Ide> ide, inode* inode_meta, uint32_t number) {
-        bl->lock();
+    uint32_t shrink(uint32_t bytes) override {
+        if (!rw->try_lock()) return 0;
+        uint32_t freed = 0;
+        // the least used first, a round over every set at a time
+        for (uint32_t most = 0; freed < bytes; most = most * 2 + 1) {
+            bool any = false;
+            for (uint32_t x = 0; x < rows_e && freed < bytes; x++) {
+                for (uint32_t y = 0; y < size_of_inner_array && freed < bytes; y++) {
+                    auto it = my_cache[x][y];
+                    if (it == nullptr) continue;
+                    any = true;
+                    if (it->counter > most) continue;
+                    delete[] it->data;
+                    it->data = nullptr;
+                    delete it;
+                    my_cache[x][y] = nullptr;
+                    freed += bs;
+                    held -= bs;
+                }
+            }
+            if (!any) break;
+        }
+        rw->unlock();
+        return freed;
+    }
+
+    uint32_t size() override {
+        return held;
+    }
+
+    // copies the block to buffer if we have it, rw has to be held
+    bool hit(uint32_t index_of_set, uint32_t indexc, uint32_t number, char* buffer) {
+        for(uint32_t x = 0; x < size_of_inner_array; x++) {
+            auto it = my_cache[index_of_set][x];
+            if(it != nullptr && it->index == indexc && it->num == number) {
+                __atomic_add_fetch(&it->counter, 1, __ATOMIC_RELAXED);
+                useful();
+                memcpy(buffer, it->data, bs);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void getValue(uint32_t indexc, char* buffer, Borrowed<Ide> ide, inode* inode_meta, uint32_t number) {
         auto index_of_set = indexc & 0xF; 
 
+        {
+            ReadGuard g{*rw};
+            if (hit(index_of_set, indexc, number, buffer)) return;
+        }
+
+        // miss, go to the disk without holding up the readers
+        auto data = new char[bs];
+        read_block_private(indexc, data, ide, inode_meta);
+        memcpy(buffer, data, bs);
+
+        if (install(index_of_set, indexc, number, data)) {
+            Pressure::grew(this);
+        }
+    }
+
+    // puts the block in its set, true if we hold one more than before
+    bool install(uint32_t index_of_set, uint32_t indexc, uint32_t number, char* data) {
+        LockGuard g{*rw};
+
         auto num_to_put = -1; 
         auto num = -1; 
-        auto hard_num = -1; 
 
 
         for(uint32_t x = 0; x < size_of_inner_array; x++) {
@@ -165,15 +240,11 @@ public:
             if(my_cache[index_of_set][x] != nullptr) {
 
                 if((my_cache[index_of_set][x])->index == indexc && my_cache[index_of_set][x]->num == number) {
-                    (my_cache[index_of_set][x])->counter++;
-                    memcpy(buffer, (my_cache[index_of_set][x])->data, bs);
-                    bl->unlock();
-                    return; 
+                    // somebody beat us to it
+                    delete[] data;
+                    return false; 
                 } else {
                     if(num == -1 || my_cache[index_of_set][x]->counter < my_cache[index_of_set][num]->counter) { 
-                        if(my_cache[index_of_set][x]->index != my_cache[index_of_set][indexc]->index) {
-                            hard_num = x; 
-                        }
                         num = x; 
                     }
                 }
@@ -185,33 +256,29 @@ public:
         if(num_to_put == -1) {
             // delete (my_cache[index_of_set][num]);
             // auto current_item = my_cache[index_of_set][num];
-            if(hard_num != -1) {
-                num = hard_num; 
-            }
             auto current_item = my_cache[index_of_set][num];
             current_item->index = indexc;
             current_item->num = number;
             current_item->counter = 0;
-            read_block_private(indexc, current_item->data, ide, inode_meta);
+            delete[] current_item->data;
+            current_item->data = data;
             my_cache[index_of_set][num] = current_item;
-            memcpy(buffer, current_item->data, bs);
+            return false;
 
         } else {
             auto current_item = new block_data_meta;
             current_item->index = indexc;
             current_item->num = number;
             current_item->counter = 0;
-            current_item->data = new char[bs];
-            read_block_private(indexc, current_item->data, ide, inode_meta);
+            current_item->data = data;
             my_cache[index_of_set][num_to_put] = current_item;
-            memcpy(buffer, current_item->data, bs);
+            held += bs;
+            return true;
         }
 
-        bl->unlock();
-
     }
 
-    void read_block_private(uint32_t number, char* buffer, Shared<Ide> ide_life, inode* inode_meta) {
+    void read_block_private(uint32_t number, char* buffer, Borrowed<Ide> ide_life, inode* inode_meta) {
 
     uint32_t block_size_x = bs;
     if(number <= 11) {
@@ -271,11 +338,11 @@ public:
     file_node * head; 
     Cache_Block * block_cache_e; 
     uint32_t entries_counted; 
-    Node(uint32_t block_size, uint32_t number_e, SuperBlock* temp , Shared<Ide> ide, BGDT_struct * bgdt_array, Cache_Block * block_cache) : BlockIO(block_size) {
+    Node(uint32_t block_size, uint32_t number_e, SuperBlock* temp , Borrowed<Ide> ide, BGDT_struct * bgdt_array, Cache_Block * block_cache) : BlockIO(block_size) {
         block_cache_e = block_cache;
         block_size_x = block_size;
         super_block = temp;
-        ide_life = ide; 
+        ide_life = ide.share(); 
         inode_meta = new inode;
         bgdt_array_node = bgdt_array;
         head = new file_node(0);
@@ -306,8 +373,9 @@ public:
     virtual ~Node() {}
 
     char* read_bmp() {
-        char* file_header = new char[14];
-        char* info_header = new char[40];
+        ArenaScope scratch;
+        char* file_header = scratch.alloc<char>(14);
+        char* info_header = scratch.alloc<char>(40);
         this->read_all(0, 14, (char*) file_header);
         this->read_all(14, 40, (char*) info_header);
 
@@ -331,7 +399,7 @@ public:
         // uint32_t width = 70;
         // uint32_t height = 70;
         
-        uint8_t* buf = new uint8_t[size-138];
+        uint8_t* buf = scratch.alloc<uint8_t>(size-138);
         this->read_all(138, size-138, (char*) buf);
 
         char* ret_shob = new char[((size-138) / 4) * 3];
@@ -341,9 +409,6 @@ public:
             ret_shob[rIdx + 1] = buf[i + 1]; // green
             ret_shob[rIdx + 2] = buf[i]; // blue
         }
-        delete[] buf; 
-        delete[] file_header;
-        delete[] info_header;
         return ret_shob;
     }
 
@@ -502,17 +567,28 @@ public:
 struct temp_node {
     Shared<Node> node; 
     uint32_t counter; 
+    Epoch::Retired retired;     // so shrink() can retire it without allocating
 };
 
-class Cache {
+// Lookups don't take a lock at all, they run inside an Epoch::Guard.
+// Filling a slot is serialized by "bl" and an evicted entry is retired
+// rather than deleted, a reader could still be looking at it.
+//
+// A Shrinker like Cache_Block, it gives back the least used inodes first.
+class Cache : public Shrinker {
 
 public:
 
     temp_node *** my_cache; 
     uint32_t size_of_inner_array; 
+    uint32_t rows_e;
     BlockingLock * bl; 
+    volatile uint32_t held = 0;         // entries, under bl
 
-    Cache(uint32_t rows, uint32_t columns) {
+    // what an entry costs us, its node goes with it unless someone else has it
+    static constexpr uint32_t ENTRY_BYTES = sizeof(temp_node) + sizeof(Node);
+
+    Cache(uint32_t rows, uint32_t columns) : Shrinker("ext2 inodes") {
 
         my_cache = new temp_node**[rows];
         for(uint32_t x = 0; x < rows; x++) {
@@ -524,22 +600,74 @@ public:
 
         bl = new BlockingLock();
         size_of_inner_array = columns; 
+        rows_e = rows;
 
+        Pressure::add(this);
     }
 
-    Shared<Node> getValue(uint32_t index, file_node * temp, Shared<Node> dir, SuperBlock * super_block, Cache_Block * block_cache) {
-        bl->lock();
+    uint32_t shrink(uint32_t bytes) override {
+        if (!bl->try_lock()) return 0;
+        uint32_t freed = 0;
+        // the least used first, a round over every set at a time
+        for (uint32_t most = 0; freed < bytes; most = most * 2 + 1) {
+            bool any = false;
+            for (uint32_t x = 0; x < rows_e && freed < bytes; x++) {
+                for (uint32_t y = 0; y < size_of_inner_array && freed < bytes; y++) {
+                    auto it = my_cache[x][y];
+                    if (it == nullptr) continue;
+                    any = true;
+                    if (__atomic_load_n(&it->counter, __ATOMIC_RELAXED) > most) continue;
+                    __atomic_store_n(&my_cache[x][y], nullptr, __ATOMIC_RELEASE);
+                    Epoch::retire(it, it->retired);
+                    freed += ENTRY_BYTES;
+                    held -= 1;
+                }
+            }
+            if (!any) break;
+        }
+        bl->unlock();
+        // What we retired isn't freed while readers may still have it. Only say
+        // we gave memory back if it is back, otherwise an allocation that
+        // relieve() was called for would try again for nothing.
+        if (freed != 0 && !Epoch::collect()) freed = 0;
+        return freed;
+    }
+
+    uint32_t size() override {
+        return held * ENTRY_BYTES;
+    }
+
+    temp_node* entry(uint32_t index_of_set, uint32_t x) {
+        return __atomic_load_n(&my_cache[index_of_set][x], __ATOMIC_ACQUIRE);
+    }
+
+    Shared<Node> getValue(uint32_t index, file_node * temp, Borrowed<Node> dir, SuperBlock * super_block, Cache_Block * block_cache) {
         auto index_of_set = index & 0x1F; 
 
+        {
+            Epoch::Guard g;
+            for(uint32_t x = 0; x < size_of_inner_array; x++) {
+                auto it = entry(index_of_set, x);
+                if(it != nullptr && it->node->number == index) {
+                    __atomic_add_fetch(&it->counter, 1, __ATOMIC_RELAXED);
+                    useful();
+                    return it->node;
+                }
+            }
+        }
+
+        bl->lock();
+
         auto num_to_put = -1; 
         auto num = -1; 
 
         for(uint32_t x = 0; x < size_of_inner_array; x++) {
             if(my_cache[index_of_set][x] != nullptr) {
                 if((my_cache[index_of_set][x])->node->number == index) {
-                    (my_cache[index_of_set][x])->counter++;
+                    // filled while we waited for the lock
+                    auto out = (my_cache[index_of_set][x])->node;
                     bl->unlock();
-                    return (my_cache[index_of_set][x])->node;
+                    return out;
                 } else {
                     if(num == -1 ||  my_cache[index_of_set][num]->counter > my_cache[index_of_set][x]->counter) {
                         num = x; 
@@ -550,17 +678,23 @@ public:
             }
         }
 
+        temp_node * old = nullptr;
         if(num_to_put == -1) {
-            delete (my_cache[index_of_set][num]);
+            old = my_cache[index_of_set][num];
         } else {
             num = num_to_put; 
+            held += 1;
         }
         temp_node * stuff = new temp_node; 
         stuff->node = Shared<Node>::make(((1 << 10) << super_block->block_size_shifter), temp->file->inode_number, super_block, dir->ide_life, dir->bgdt_array_node, block_cache);
         stuff->counter = 0; 
-        my_cache[index_of_set][num] = stuff; 
+        __atomic_store_n(&my_cache[index_of_set][num], stuff, __ATOMIC_RELEASE);
+        auto out = stuff->node;
         bl->unlock();
-        return stuff->node;
+
+        if (old != nullptr) Epoch::retire(old, old->retired);
+        else Pressure::grew(this);
+        return out;
     }
 
 };
@@ -604,7 +738,7 @@ public:
     // Returns a null reference if "name" doesn't exist in the directory
     //
     // Panics if "dir" is not a directory
-    Shared<Node> find(Shared<Node> dir, const char* name);
+    Shared<Node> find(Borrowed<Node> dir, const char* name);
     void printSuperBlock();
 
 };
@@ -0,0 +1,78 @@
+#include "fpu.h"
+#include "machine.h"
+#include "debug.h"
+#include "idt.h"
+#include "smp.h"
+#include "threads.h"
+
+namespace gheith {
+
+    constexpr uint32_t NM_vector = 7;
+
+    struct alignas(64) FpuCore {
+        TCB* lastOwner = nullptr;   // whose state the registers hold
+        bool live = false;          // TS is clear, lastOwner is running
+    };
+
+    static PerCPU<FpuCore> fpuCores{};
+
+    // what a thread starts with, fninit plus the default MXCSR
+    alignas(16) static uint8_t pristine[512];
+
+    static bool hasFxsr = false;
+    static bool hasSse2 = false;
+
+    // me is leaving the core, preemption is off
+    void fpuSwitch(uint32_t core_id, TCB* me) {
+        auto& c = fpuCores.forCPU(core_id);
+        if (!c.live) return;
+        if (me->fpu != nullptr) fxsave(me->fpu);
+        setTS();
+        c.live = false;
+    }
+}
+
+void Fpu::init() {
+    using namespace gheith;
+
+    cpuid_out out;
+    cpuid(1,&out);
+    hasFxsr = (out.d & (1 << 24)) != 0;
+    hasSse2 = hasFxsr && ((out.d & (1 << 26)) != 0);
+
+    // without FXSAVE we leave the FPU alone, nobody gets SSE
+    if (!hasFxsr) return;
+
+    fpuInit();
+    if (SMP::me() == 0) {
+        fxsave(pristine);
+        IDT::interrupt(NM_vector, (uint32_t)nmHandler_);
+    }
+    setTS();
+}
+
+bool Fpu::sse2() {
+    return gheith::hasSse2;
+}
+
+// #NM: the running thread wants the FPU and CR0.TS is set
+extern "C" void nmHandler() {
+    using namespace gheith;
+
+    auto id = SMP::me();
+    auto me = activeThreads[id];
+    auto& c = fpuCores.forCPU(id);
+
+    clts();
+    if (me->fpu == nullptr) {
+        // Idle threads and early boot. They get a clean FPU but nothing
+        // is kept for them, whoever had the registers reloads
+        fxrstor(pristine);
+        c.lastOwner = nullptr;
+    } else if ((c.lastOwner != me) || (me->fpuCore != id)) {
+        fxrstor((me->fpuCore == NO_CORE) ? pristine : me->fpu);
+        c.lastOwner = me;
+        me->fpuCore = id;
+    }
+    c.live = true;
+}
@@ -0,0 +1,30 @@
+#ifndef _fpu_h_
+#define _fpu_h_
+
+#include "stdint.h"
+
+// Lazy FPU/SSE context switching.
+//
+// A thread only pays for the FPU if it uses it. Every core starts a time
+// slice with CR0.TS set, so the first x87/SSE instruction traps (#NM)
+// and the handler loads the thread's state before letting it go on. A
+// thread that used the FPU during its slice gets its state saved
+// (FXSAVE, into its TCB) when it leaves the core. If it comes back to
+// the same core and nobody else touched the FPU in between the
+// registers are still good and the trap only clears TS.
+//
+// The kernel is built with -mno-sse. Files named *_simd.cc are built
+// with -msse2 instead (see the Makefile) and can use vectors freely, as
+// long as they run in threads: never in interrupt handlers, Timer
+// callbacks or Deferred work. Those would be using the interrupted
+// thread's registers. The idle thread gets no saved state either.
+class Fpu {
+public:
+    // every core, before it enables interrupts
+    static void init();
+
+    // can *_simd.cc code run at all?
+    static bool sse2();
+};
+
+#endif
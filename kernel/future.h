@@ -35,6 +35,17 @@ public:
         return t;
     }
 
+    // Like get() but gives up after timeout_ms. Returns false if the value
+    // wasn't set by then
+    bool get(T& out, uint32_t timeout_ms) {
+        if (!isReady) {
+            if (!go.down(timeout_ms)) return false;
+            go.up();
+        }
+        out = t;
+        return true;
+    }
+
 };
 
 #endif
@@ -3,8 +3,20 @@
 #include "stdint.h"
 #include "blocking_lock.h"
 #include "atomic.h"
-
-/* A first-fit heap */
+#include "slab.h"
+#include "physmem.h"
+#include "pressure.h"
+#include "config.h"
+
+/* A first-fit heap, with size-class slabs in front of it (slab.h) for
+ * the small blocks.
+ *
+ * It starts out with the range heapInit gets and grows in big chunks
+ * from PhysMem when that runs out. Every chunk has a taken block at
+ * either end, like the initial range, so blocks never merge across
+ * chunks. A chunk that becomes all free again goes back to PhysMem,
+ * except for one we keep around so a big block that comes and goes
+ * doesn't make us grow and shrink every time. */
 
 
 namespace gheith {
@@ -14,6 +26,20 @@ static int len;
 static int safe = 0;
 static int avail = 0;
 static BlockingLock *theLock = nullptr;
+static uint32_t heapBytes = 0;
+
+// what we got from PhysMem, in ints from array
+struct Chunk {
+    int first;
+    int ints;
+};
+
+constexpr uint32_t MAX_CHUNKS = 64;
+constexpr uint32_t GROW_FRAMES = 1024;      // 4MB at a time, if PhysMem has it
+
+static Chunk chunks[MAX_CHUNKS];
+static uint32_t chunkCount = 0;
+static int spare = -1;                      // an all free chunk we hold on to
 
 void makeTaken(int i, int ints);
 void makeAvail(int i, int ints);
@@ -134,25 +160,75 @@ void heapInit(void* base, size_t bytes) {
     makeTaken(0,2);
     makeAvail(2,len-4);
     makeTaken(len-2,2);
+    heapBytes = bytes;
     theLock = new BlockingLock();
+    // spans can end up anywhere we can grow into
+    Slab::init(base,kConfig.memSize - (uint32_t) base);
 }
 
-void* malloc(size_t bytes) {
-    using namespace gheith;
-    //Debug::printf("malloc(%d)\n",bytes);
-    if (bytes == 0) return (void*) array;
+namespace gheith {
 
-    int ints = ((bytes + 3) / 4) + 2;
-    if (ints < 4) ints = 4;
+    // theLock held
+    static bool grow(int ints) {
+        if (chunkCount == MAX_CHUNKS) return false;
+
+        // room for the taken blocks at the ends
+        uint32_t needFrames = PhysMem::frameup((ints + 4) * 4) / PhysMem::FRAME_SIZE;
+        uint32_t frames = (needFrames > GROW_FRAMES) ? needFrames : GROW_FRAMES;
+        uint32_t pa = 0;
+        while (true) {
+            pa = PhysMem::alloc_contiguous(frames);
+            if ((pa != 0) || (frames == needFrames)) break;
+            frames = (frames / 2 > needFrames) ? frames / 2 : needFrames;
+        }
+        if (pa == 0) return false;
+        ASSERT(pa > (uint32_t) array);
+
+        int first = (pa - (uint32_t) array) / 4;
+        int n = frames * PhysMem::FRAME_SIZE / 4;
+        makeTaken(first,2);
+        makeAvail(first+2,n-4);
+        makeTaken(first+n-2,2);
+        if (first + n > len) len = first + n;
+
+        chunks[chunkCount++] = Chunk{first, n};
+        heapBytes += n * 4;
+        return true;
+    }
 
-    LockGuardP g{theLock};
+    // theLock held
+    static void shrink(uint32_t c) {
+        auto it = chunks[c];
+        remove(it.first+2);
+        PhysMem::dealloc_contiguous((uint32_t) &array[it.first], it.ints * 4 / PhysMem::FRAME_SIZE);
+        heapBytes -= it.ints * 4;
 
-    void* res = 0;
+        chunks[c] = chunks[--chunkCount];
+        if (spare == int(chunkCount)) spare = c;
+    }
+
+    static inline bool allFree(const Chunk& it) {
+        return array[it.first+2] == it.ints - 4;
+    }
 
-    int mx = 0x7FFFFFFF;
-    int it = 0;
+    // theLock held, the free block at i runs from one end of its chunk
+    // to the other
+    static void emptied(int i) {
+        for (uint32_t c=0; c<chunkCount; c++) {
+            if (chunks[c].first + 2 != i) continue;
+            if ((spare >= 0) && (spare != int(c)) && allFree(chunks[spare])) {
+                shrink(c);
+            } else {
+                spare = c;
+            }
+            return;
+        }
+    }
 
-    {
+    // theLock held, the smallest of the first 20 that fit, 0 if none do
+    static int bestFit(int ints, int& mx) {
+        mx = 0x7FFFFFFF;
+        int it = 0;
         int countDown = 20;
         int p = avail;
         while (p != 0) {
@@ -171,6 +247,22 @@ void* malloc(size_t bytes) {
             }
             p = next(p);
         }
+        return it;
+    }
+}
+
+void* gheith::firstFitAlloc(size_t bytes) {
+    int ints = ((bytes + 3) / 4) + 2;
+    if (ints < 4) ints = 4;
+
+    LockGuardP g{theLock};
+
+    void* res = 0;
+
+    int mx;
+    int it = bestFit(ints, mx);
+    if ((it == 0) && grow(ints)) {
+        it = bestFit(ints, mx);
     }
 
     if (it != 0) {
@@ -188,11 +280,7 @@ void* malloc(size_t bytes) {
     return res;
 }
 
-void free(void* p) {
-    using namespace gheith;
-    if (p == 0) return;
-    if (p == (void*) array) return;
-
+void gheith::firstFitFree(void* p) {
     LockGuardP g{theLock};
 
     int idx = ((((uintptr_t) p) - ((uintptr_t) array)) / 4) - 1;
@@ -219,15 +307,224 @@ void free(void* p) {
     }
 
     makeAvail(idx,sz);
+
+    // taken blocks of 2 ints on both sides only happen at chunk ends
+    if ((array[idx-1] == -2) && (array[idx+sz] == -2)) {
+        emptied(idx);
+    }
+}
+
+namespace gheith {
+
+    static void* tryAlloc(size_t bytes) {
+        if (bytes <= Slab::MAX_BYTES) {
+            auto p = Slab::alloc(bytes);
+            if (p != nullptr) return p;
+        }
+        return firstFitAlloc(bytes);
+    }
+
+    static void* rawAlloc(size_t bytes) {
+        auto p = tryAlloc(bytes);
+        if ((p == nullptr) && (Pressure::relieve(bytes) != 0)) {
+            p = tryAlloc(bytes);
+        }
+        return p;
+    }
+
+    static void rawFree(void* p) {
+        if (Slab::owns(p)) {
+            Slab::free(p);
+        } else {
+            firstFitFree(p);
+        }
+    }
+
+#ifdef HEAP_STATS
+
+    // In front of every block. 16 bytes, so slab blocks stay 8 byte
+    // aligned
+    struct Tag {
+        Tag* next;
+        Tag* prev;
+        const void* site;
+        uint32_t bytes;
+    };
+
+    struct Site {
+        const void* site;       // nullptr: the slot is free
+        uint32_t allocs;
+        uint32_t frees;
+        uint32_t liveCount;
+        uint32_t liveBytes;
+        uint32_t peakBytes;
+    };
+
+    constexpr uint32_t SITES = 512;     // a power of 2
+
+    static Site sites[SITES];
+    static Site otherSites{};           // once the table is full
+    static Tag* live = nullptr;         // every block that hasn't been freed
+    static uint32_t liveBytes = 0;
+    static uint32_t peakBytes = 0;
+    static uint32_t allocs = 0;
+    static uint32_t frees = 0;
+    static bool warned = false;
+    static InterruptSafeLock statsLock{};
+
+    static Site& siteFor(const void* site) {
+        uint32_t h = (uintptr_t(site) >> 2) * 2654435761u;
+        for (uint32_t i=0; i<SITES; i++) {
+            auto& it = sites[(h + i) & (SITES - 1)];
+            if (it.site == site) return it;
+            if (it.site == nullptr) {
+                it.site = site;
+                return it;
+            }
+        }
+        return otherSites;
+    }
+
+    static void* allocate(size_t bytes, const void* site) {
+        auto t = (Tag*) rawAlloc(bytes + sizeof(Tag));
+        if (t == nullptr) return nullptr;
+        t->site = site;
+        t->bytes = bytes;
+
+        bool warn = false;
+        {
+            LockGuard g{statsLock};
+            t->prev = nullptr;
+            t->next = live;
+            if (live != nullptr) live->prev = t;
+            live = t;
+
+            allocs ++;
+            liveBytes += bytes;
+            if (liveBytes > peakBytes) peakBytes = liveBytes;
+
+            auto& s = siteFor(site);
+            s.allocs ++;
+            s.liveCount ++;
+            s.liveBytes += bytes;
+            if (s.liveBytes > s.peakBytes) s.peakBytes = s.liveBytes;
+
+            if (!warned && (liveBytes > heapBytes / 8 * 7)) {
+                warned = true;
+                warn = true;
+            }
+        }
+        if (warn) {
+            Debug::printf("| heap: more than 7/8 in use, the last one from 0x%x\n", (uint32_t) site);
+        }
+        return t + 1;
+    }
+
+    static void release(void* p) {
+        auto t = ((Tag*) p) - 1;
+        {
+            LockGuard g{statsLock};
+            if (t->prev != nullptr) t->prev->next = t->next; else live = t->next;
+            if (t->next != nullptr) t->next->prev = t->prev;
+
+            frees ++;
+            liveBytes -= t->bytes;
+
+            auto& s = siteFor(t->site);
+            s.frees ++;
+            s.liveCount --;
+            s.liveBytes -= t->bytes;
+        }
+        rawFree(t);
+    }
+
+#else
+
+    static inline void* allocate(size_t bytes, const void*) {
+        return rawAlloc(bytes);
+    }
+
+    static inline void release(void* p) {
+        rawFree(p);
+    }
+
+#endif
+}
+
+void* malloc(size_t bytes) {
+    using namespace gheith;
+    //Debug::printf("malloc(%d)\n",bytes);
+    if (bytes == 0) return (void*) array;
+    return allocate(bytes, __builtin_return_address(0));
+}
+
+void free(void* p) {
+    using namespace gheith;
+    if (p == 0) return;
+    if (p == (void*) array) return;
+    release(p);
 }
 
+HeapStats heapStats() {
+    using namespace gheith;
+    HeapStats out{};
+    {
+        LockGuardP g{theLock};
+        out.heapBytes = heapBytes;
+        for (int p = avail; p != 0; p = next(p)) {
+            uint32_t bytes = (size(p) - 2) * 4;     // header and footer
+            out.freeBlocks ++;
+            out.freeBytes += bytes;
+            if (bytes > out.largestFree) out.largestFree = bytes;
+        }
+    }
+    out.slabBytes = Slab::spanBytes();
+    return out;
+}
 
+void heapReport() {
+    using namespace gheith;
+    auto h = heapStats();
+    auto fragmented = (h.freeBytes == 0) ? 0 : (h.freeBytes - h.largestFree) / (h.freeBytes / 100 + 1);
+    Debug::printf("| heap: %u bytes, %u free in %u blocks, largest %u (%u%% fragmented), %u in slab spans\n",
+        h.heapBytes, h.freeBytes, h.freeBlocks, h.largestFree, fragmented, h.slabBytes);
+    Pressure::report();
+
+#ifdef HEAP_STATS
+    LockGuard g{statsLock};
+    Debug::printf("| heap: %u bytes live, %u at most, %u allocations, %u frees\n",
+        liveBytes, peakBytes, allocs, frees);
+
+    // the sites holding the most, biggest first
+    constexpr uint32_t TOP = 20;
+    bool shown[SITES] = {};
+    for (uint32_t n=0; n<TOP; n++) {
+        Site* best = nullptr;
+        uint32_t bestIndex = 0;
+        for (uint32_t i=0; i<SITES; i++) {
+            auto& it = sites[i];
+            if (shown[i] || (it.liveCount == 0)) continue;
+            if ((best == nullptr) || (it.liveBytes > best->liveBytes)) {
+                best = &it;
+                bestIndex = i;
+            }
+        }
+        if (best == nullptr) break;
+        shown[bestIndex] = true;
+        Debug::printf("| heap: 0x%x %u live in %u blocks, %u at most, %u allocations\n",
+            (uint32_t) best->site, best->liveBytes, best->liveCount, best->peakBytes, best->allocs);
+    }
+    if (otherSites.liveCount != 0) {
+        Debug::printf("| heap: other sites %u live in %u blocks\n", otherSites.liveBytes, otherSites.liveCount);
+    }
+#endif
+}
 /*****************/
 /* C++ operators */
 /*****************/
 
 void* operator new(size_t size) {
-    void* p =  malloc(size);
+    void* p =  gheith::allocate(size, __builtin_return_address(0));
     if (p == 0) Debug::panic("out of memory");
     return p;
 }
@@ -241,7 +538,7 @@ void operator delete(void* p, size_t sz) {
 }
 
 void* operator new[](size_t size) {
-    void* p =  malloc(size);
+    void* p =  gheith::allocate(size, __builtin_return_address(0));
     if (p == 0) Debug::panic("out of memory");
     return p;
 }
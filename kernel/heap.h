@@ -7,4 +7,34 @@ extern void heapInit(void* start, size_t bytes);
 extern "C" void* malloc(size_t size);
 extern "C" void free(void* p);
 
+namespace gheith {
+    // The first-fit heap behind malloc, for blocks the slab doesn't
+    // handle and for the slab's own spans
+    extern void* firstFitAlloc(size_t bytes);
+    extern void firstFitFree(void* p);
+}
+
+// What the heap looks like right now. The free list numbers are for
+// the first-fit heap, memory sitting in slab spans counts as used there.
+struct HeapStats {
+    uint32_t heapBytes;
+    uint32_t freeBytes;
+    uint32_t freeBlocks;
+    uint32_t largestFree;       // the biggest malloc that can work
+    uint32_t slabBytes;         // in spans, free or not
+};
+
+extern HeapStats heapStats();
+
+// Fragmentation, what every cache holds (pressure.h), and with
+// -DHEAP_STATS the live bytes, the high-water mark and the call sites
+// that hold the most memory, on the console.
+// Debug::shutdown calls it in HEAP_STATS builds, whatever is still live
+// by then is most likely a leak. Sites are return addresses, look them
+// up with addr2line.
+extern void heapReport();
+
+// placement new, constructs in memory we already have
+inline void* operator new(size_t, void* where) noexcept { return where; }
+
 #endif
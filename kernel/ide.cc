@@ -57,6 +57,8 @@ static void waitForDrive(uint32_t drive) {
     }
 }
 
+LockStats Ide::lockStats[4] = { {"ide",0}, {"ide",1}, {"ide",2}, {"ide",3} };
+
 static uint32_t nRead = 0;
 static uint32_t nWrite = 0;
 
@@ -22,13 +22,16 @@ class Ide : public BlockIO {  // We are a block device
     
     uint32_t drive; /* 0 -> A, 1 -> B, 2 -> C, 3 -> D */
 
-    InterruptSafeLock lock;
+    InterruptSafeTicketLock lock;
+    static LockStats lockStats[4];
 
     // Atomic<uint32_t> ref_count;
 
 public:
     Atomic<uint32_t> ref_count{0};
-    Ide(uint32_t drive) : BlockIO(sector_size), drive(drive), ref_count(0) {}
+    Ide(uint32_t drive) : BlockIO(sector_size), drive(drive), ref_count(0) {
+        lock.track(&lockStats[drive]);
+    }
 
     virtual ~Ide() {}
     
@@ -13,6 +13,8 @@
 #include "crt.h"
 #include "stdint.h"
 #include "physmem.h"
+#include "softirq.h"
+#include "fpu.h"
 
 struct Stack {
     static constexpr int BYTES = 4096;
@@ -111,6 +113,7 @@ extern "C" void kernelInit(void) {
         /* initialize IDT */
         IDT::init();
         Pit::calibrate(44100);
+        Fpu::init();
 
         SMP::running.fetch_add(1);
 
@@ -129,6 +132,7 @@ extern "C" void kernelInit(void) {
     } else {
         SMP::running.fetch_add(1);
         SMP::init(false);
+        Fpu::init();
     }
 
     // Initialize the PIT
@@ -141,6 +145,8 @@ extern "C" void kernelInit(void) {
 
     auto myOrder = howManyAreHere.add_fetch(1);
     if (myOrder == kConfig.totalProcs) {
+        Softirq::init();
+        PhysMem::startZeroing();
         thread([] {
 
             kernelMain();
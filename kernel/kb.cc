@@ -1,4 +1,10 @@
 #include "kb.h"
+#include "timer.h"
+#include "pit.h"
+#include "arena.h"
+
+// how long the search box cursor stays on (or off)
+constexpr uint32_t BLINK_MS = 250;
 
 kb::kb(VGA* vga): vga(vga) {}
 
@@ -42,18 +48,20 @@ void kb::kbInit(Shared<Node> logo, Shared<Semaphore> spot) {
     vga->drawRectangle(87, 95, 232, 105, 63, 1); // text box
     vga->drawString(88, 96, (const char*)"Type program name:", vga->bg_color); // enter spotify
 
-    char* program = new char[8]; // name of program typed in
+    Arena typing{}; // whatever we type into, let go of on tab
+    char* program = typing.alloc<char>(8); // name of program typed in
     int len = 0; // length of name
     bool start = 0; // if user has started typing
     int size = 8; // size of array
     program[7] = 0; // null terminator
     while (1) {
-        while ((inb(STATUS_REG) & 0x1) == 0) {} // poll for first key press.
+        while ((inb(STATUS_REG) & 0x1) == 0) sleep_ms(1); // poll for first key press.
         int val = inb(DATA_PORT);
         char c = ascii[val];
         if (val == 0xF) { // tab, start reading for input to string
             vga->drawRectangle(87, 95, 232, 104, 63, 1); // text box
-            program = new char[8]; // starting new input, clear array just in case
+            typing.reset();
+            program = typing.alloc<char>(8); // starting new input, clear array just in case
             start = 1; // mark as started typing
         }
         if (c == '\n') { // enter
@@ -68,13 +76,13 @@ void kb::kbInit(Shared<Node> logo, Shared<Semaphore> spot) {
                 program[len] = 0;
                 vga->drawRectangle(87, 95, 232, 104, 63, 1); // text box
                 if (len > 22) { // code to make it appear as if the text box is "scrolling" when the user types a lot.
-                    char* tempname = new char[22];
+                    ArenaScope scratch;
+                    char* tempname = scratch.alloc<char>(22);
                     for (int i = 0; i < 22; i++) {
                         tempname[i] = program[len - 22 + i];
                     }
                     vga->drawRectangle(87, 95, 232, 104, 63, 1); // text box
                     vga->drawString(88, 96, program, vga->bg_color);
-                    delete[] tempname;
                 } else {
                     vga->drawString(88, 96, program, vga->bg_color); // else we can show the string normally.
                 }
@@ -86,23 +94,20 @@ void kb::kbInit(Shared<Node> logo, Shared<Semaphore> spot) {
             program[len++] = c;
             program[len] = 0;
             if (len > size) { // name goes past size of array.
-                char* temp = new char[len * 2 + 10];
+                char* bigger = typing.alloc<char>(len * 2 + 10);
                 size = len * 2 + 10;
-                memcpy(temp, program, len);
-                delete[] program;
-                program = new char[len * 2 + 10];
-                memcpy(program, temp, len);
-                delete[] temp;
+                memcpy(bigger, program, len);
+                program = bigger;
             }
             vga->drawRectangle(151, 96, 232, 104, 63, 1); // text box
             if (len > 22) { // make it appear as if it is "scrolling" same as above while loop
-                char* tempname = new char[22];
+                ArenaScope scratch;
+                char* tempname = scratch.alloc<char>(22);
                 for (int i = 0; i < 22; i++) {
                     tempname[i] = program[len - 22 + i];
                 }
                 vga->drawRectangle(151, 96, 232, 104, 63, 1); // text box
                 vga->drawString(88, 96, program, vga->bg_color);
-                delete[] tempname;
             } else {
                 vga->drawString(88, 96, program, vga->bg_color); // can display it normally
             }
@@ -110,7 +115,7 @@ void kb::kbInit(Shared<Node> logo, Shared<Semaphore> spot) {
     }
 
     if (K::streq(program, (const char*)"pentos player")) { // we only have one program, so only one check needed.
-        delete[] program;
+        typing.reset();
         vga->bootup(logo); // "bootup" screen to emulate the program loading, really it was pretty instant.
         spot->up(); // for integration, tell other software (graphics and sound) the program is being started.
 
@@ -118,7 +123,7 @@ void kb::kbInit(Shared<Node> logo, Shared<Semaphore> spot) {
 
         vga->drawRectangle(70, 9, 250, 19, 63, 1); // text box
         vga->drawString(70, 10, (const char*)"Press tab to search...", vga->bg_color); // enter spotify
-        char* name = new char[100];
+        char* name = typing.alloc<char>(100);
         char* temp = new char[100];
         int len = 0;
         bool start = 0;
@@ -128,12 +133,12 @@ void kb::kbInit(Shared<Node> logo, Shared<Semaphore> spot) {
         bool startCursor = false; 
         // start polling/interrupts
         while (1) {
-            uint32_t counter = 0; 
+            uint32_t blink = Pit::jiffies + Pit::msToJiffies(BLINK_MS);
             while ((inb(STATUS_REG) & 0x1) == 0) {
                     if(startCursor) { // code to display blinking cursor in text box. I'm getting tired of commenting so it'll be less and less now...
-                        if(counter > 42949) {
+                        if(int32_t(Pit::jiffies - blink) >= 0) {
                         cursor = !cursor;
-                        counter = 0; 
+                        blink = Pit::jiffies + Pit::msToJiffies(BLINK_MS);
                         vga->drawRectangle(70, 9, 250, 19, 63, 1);
                         }
                         if(printing) {
@@ -142,13 +147,13 @@ void kb::kbInit(Shared<Node> logo, Shared<Semaphore> spot) {
                         }
                         name[len] = cursor ? '_' : '\0';
                         name[len + 1] = '\0';
-                        counter++; 
                         if(!printing) {
                             vga->drawString(70, 10, name, vga->bg_color);
                         } else {
                             vga->drawString(70, 10, temp, vga->bg_color);
                         }
                     }
+                    sleep_ms(1);
             }
             int val = inb(DATA_PORT);
             char c = ascii[val];
@@ -163,7 +168,8 @@ void kb::kbInit(Shared<Node> logo, Shared<Semaphore> spot) {
             if (val == 0xF) { // tab, start reading for user input
                 vga->drawRectangle(70, 9, 250, 19, 63, 1); // text box
                 len = 0;
-                name = new char[100];
+                typing.reset();
+                name = typing.alloc<char>(100);
                 cursor = true; 
                 size = 100;
                 start = 1;
@@ -193,7 +199,8 @@ void kb::kbInit(Shared<Node> logo, Shared<Semaphore> spot) {
                     vga->drawRectangle(70, 9, 250, 19, 63, 1); // text box
                     if (len > 22) {
                         printing = true; 
-                        char* tempname = new char[23];
+                        ArenaScope scratch;
+                        char* tempname = scratch.alloc<char>(23);
                         for (int i = 0; i < 21; i++) {
                             tempname[i] = name[len - 21 + i];
                             temp[i] = name[len - 21 + i]; 
@@ -206,8 +213,6 @@ void kb::kbInit(Shared<Node> logo, Shared<Semaphore> spot) {
 
                         vga->drawRectangle(70, 9, 250, 19, 63, 1); // text box
                         vga->drawString(70, 10, tempname, vga->bg_color);
-                    
-                        delete[] tempname;
                     } else {
                         printing = false; 
                         vga->drawString(70, 10, name, vga->bg_color);
@@ -219,17 +224,15 @@ void kb::kbInit(Shared<Node> logo, Shared<Semaphore> spot) {
                 name[len++] = c;
                 name[len] = 0;
                 if (len > size) {
-                    char* temp = new char[len * 2 + 10];
+                    char* bigger = typing.alloc<char>(len * 2 + 10);
                     size = len * 2 + 10;
-                    memcpy(temp, name, len);
-                    // delete[] name;
-                    name = new char[len * 2 + 10];
-                    memcpy(name, temp, len);
-                    delete[] temp;
+                    memcpy(bigger, name, len);
+                    name = bigger;
                 }
                 vga->drawRectangle(70, 9, 250, 19, 63, 1); // text box
                 if (len > 21) {
-                    char* tempname = new char[23];
+                    ArenaScope scratch;
+                    char* tempname = scratch.alloc<char>(23);
                     for (int i = 0; i < 21; i++) {
                         tempname[i] = name[len - 21 + i];
                         temp[i] = name[len - 21 + i];
@@ -243,7 +246,6 @@ void kb::kbInit(Shared<Node> logo, Shared<Semaphore> spot) {
 
                     vga->drawRectangle(70, 9, 250, 19, 63, 1); // text box
                     vga->drawString(70, 10, tempname, vga->bg_color);
-                    delete[] tempname;
                 } else {
                     name[len] = cursor ? '_' : '\0';
                     name[len + 1] = '\0';
@@ -264,7 +266,7 @@ void kb::kbInit(Shared<Node> logo, Shared<Semaphore> spot) {
         vga->drawString(64, 102, (const char*)"press enter to try again.", 48);
         vga->drawString(72, 111, (const char*)"press ESC to shut down.", 48);
         while (1) {
-            while ((inb(STATUS_REG) & 0x1) == 0) {} // poll for first key press.
+            while ((inb(STATUS_REG) & 0x1) == 0) sleep_ms(1); // poll for first key press.
             int val = inb(DATA_PORT);
             char c = ascii[val];
             // only accept either enter or escape
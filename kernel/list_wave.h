@@ -7,6 +7,7 @@
 #include "pit.h"
 #include "physmem.h"
 #include "atomic.h"
+#include "arena.h"
 
 // this header contains all the information from the song file
 struct Header {
@@ -44,24 +45,24 @@ class WaveParser_list {
         b_entries = (char *) PhysMem::alloc_frame();
         size_of_the_whole_file = 0;
 
+        // the 4 byte fields below only live until we are done here
+        ArenaScope scratch;
+
         // RIFF CHECK 
-        char* riff = new char[5];
+        char* riff = scratch.alloc<char>(5);
         riff[4] = '\0';
         file->read_all(0, 4, riff);
-        delete riff; 
 
         // - Size of File 
 
-        char * size_of_file = new char[5];
+        char * size_of_file = scratch.alloc<char>(5);
         file->read_all(4, 4, size_of_file);
         size_of_the_whole_file = *(uint32_t *)size_of_file;
-        delete size_of_file; 
 
         // WAVE CHECK 
-        char* wave = new char[5];
+        char* wave = scratch.alloc<char>(5);
         wave[4] = '\0';
         file->read_all(8, 4, wave);
-        delete wave; 
 
         Header* fmt_stuff = fmt; 
 
@@ -85,41 +86,42 @@ class WaveParser_list {
         }
 
         // Junk Check 
-        char* junk = new char[5];
+        char* junk = scratch.alloc<char>(5);
         junk[4] = '\0';
         file->read_all(12 + sizeof(Header), 4, junk);
-        delete junk; 
 
         // Size of junk
-        char * size_of_junk = new char[5];
+        char * size_of_junk = scratch.alloc<char>(5);
         file->read_all(12 + sizeof(Header) + 4, 4, size_of_junk);
         size_of_the_junk = 12 + sizeof(Header) + 4 + *(uint32_t *) size_of_junk + 4;
-        delete size_of_junk;
 
         // Data Check 
-        char * data_chunk_header = new char[5];               // DATA string or FLLR string
+        char * data_chunk_header = scratch.alloc<char>(5);               // DATA string or FLLR string
         data_chunk_header[4] = '\0';
         file->read_all(size_of_the_junk, 4, data_chunk_header);
         size_of_the_junk += 4; 
-        delete data_chunk_header; 
                     
         // NumSamples * NumChannels * BitsPerSample/8 - size of the next chunk that will be read
-        char * data_size = new char[5];
+        char * data_size = scratch.alloc<char>(5);
         file->read_all(size_of_the_junk, 4, data_size);
         size = *(uint32_t*)data_size; 
         size_of_the_junk += 4;
-        delete data_size;
 
         // Make 16 Pages of data 
 
         for(int i = 0; i < 16; i++) {
             char * current_entry = (b_entries + (i * 16));
-            *(uint64_t *) current_entry = PhysMem::alloc_frame();
+            *(uint64_t *) current_entry = PhysMem::alloc_frame(PhysMem::Fill::None);
             uint64_t current_addy = *(uint64_t *) current_entry; 
             ASSERT(current_addy == *(uint64_t *) current_entry);
             *(uint32_t *) (current_entry + 8) = 4096; 
             *(uint32_t *) (current_entry + 12) = 0;
-            file->read_all(size_of_the_junk+ (4096 * i), 4096, (char*) (uint64_t*)current_addy);
+            auto got = file->read_all(size_of_the_junk+ (4096 * i), 4096, (char*) (uint64_t*)current_addy);
+            if (got < 4096) {
+                // past the end of the file, the frame wasn't zeroed for us
+                uint32_t keep = (got < 0) ? 0 : uint32_t(got);
+                bzero((char*) (uint64_t*)current_addy + keep, 4096 - keep);
+            }
             offset = size_of_the_junk + (4096 * i) + 4096; 
             reset_offset = size_of_the_junk + (4096 * i) + 4096; 
         }
@@ -0,0 +1,139 @@
+#ifndef _lockfree_h_
+#define _lockfree_h_
+
+#include "stdint.h"
+#include "atomic.h"
+
+// Multi-producer single-consumer FIFO, intrusive through "next" like
+// Queue. Producers push onto a stack with a CAS, the consumer takes the
+// whole stack with one exchange and reverses it. No locks, and since the
+// consumer never pops single entries off the shared stack there is no
+// ABA problem.
+//
+// Only one thread at a time may call remove()/is_empty(). add() can be
+// called from anywhere, interrupt handlers included.
+template <typename T>
+class MPSCQueue {
+    T* volatile head = nullptr;     // shared, newest first
+    T* local = nullptr;             // consumer only, oldest first
+public:
+    MPSCQueue() {}
+    MPSCQueue(const MPSCQueue&) = delete;
+
+    void monitor_add() {
+        monitor((uintptr_t)&head);
+    }
+
+    void add(T* t) {
+        T* old = __atomic_load_n(&head,__ATOMIC_RELAXED);
+        do {
+            t->next = old;
+        } while (!__atomic_compare_exchange_n(&head,&old,t,true,__ATOMIC_RELEASE,__ATOMIC_RELAXED));
+    }
+
+    // Consumer only. Unlocked peek like Queue::is_empty
+    bool is_empty() const {
+        return (local == nullptr) && (head == nullptr);
+    }
+
+    // Consumer only
+    T* remove() {
+        if (local == nullptr) {
+            if (head == nullptr) return nullptr;
+            T* it = __atomic_exchange_n(&head,nullptr,__ATOMIC_ACQUIRE);
+            // reverse it
+            while (it != nullptr) {
+                auto next = it->next;
+                it->next = local;
+                local = it;
+                it = next;
+            }
+        }
+        auto it = local;
+        if (it != nullptr) {
+            local = it->next;
+            it->next = nullptr;
+        }
+        return it;
+    }
+};
+
+// Bounded multi-producer multi-consumer FIFO of N values (N a power of
+// 2). Every cell carries a sequence number that says whose turn it is,
+// producers and consumers claim positions with a CAS and never wait for
+// each other unless the ring is full or empty (D. Vyukov's design).
+//
+// Not intrusive: it holds copies of T, usually pointers. The padding
+// keeps the producer and consumer counters on different lines, heap
+// objects can't be aligned.
+template <typename T, uint32_t N>
+class MPMCRing {
+    static_assert((N & (N - 1)) == 0, "N has to be a power of 2");
+
+    struct Cell {
+        volatile uint32_t seq;
+        T value;
+    };
+
+    Cell cells[N];
+    char pad0[64];
+    volatile uint32_t addPos = 0;
+    char pad1[64];
+    volatile uint32_t removePos = 0;
+    char pad2[64];
+
+public:
+    MPMCRing() {
+        for (uint32_t i=0; i<N; i++) cells[i].seq = i;
+    }
+    MPMCRing(const MPMCRing&) = delete;
+
+    // false if full
+    bool try_add(const T& v) {
+        auto pos = __atomic_load_n(&addPos,__ATOMIC_RELAXED);
+        while (true) {
+            auto& cell = cells[pos & (N - 1)];
+            auto seq = __atomic_load_n(&cell.seq,__ATOMIC_ACQUIRE);
+            auto diff = int32_t(seq - pos);
+            if (diff == 0) {
+                if (__atomic_compare_exchange_n(&addPos,&pos,pos+1,true,__ATOMIC_RELAXED,__ATOMIC_RELAXED)) {
+                    cell.value = v;
+                    __atomic_store_n(&cell.seq,pos+1,__ATOMIC_RELEASE);
+                    return true;
+                }
+                // pos got reloaded by the failed CAS
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = __atomic_load_n(&addPos,__ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    // false if empty
+    bool try_remove(T& out) {
+        auto pos = __atomic_load_n(&removePos,__ATOMIC_RELAXED);
+        while (true) {
+            auto& cell = cells[pos & (N - 1)];
+            auto seq = __atomic_load_n(&cell.seq,__ATOMIC_ACQUIRE);
+            auto diff = int32_t(seq - (pos + 1));
+            if (diff == 0) {
+                if (__atomic_compare_exchange_n(&removePos,&pos,pos+1,true,__ATOMIC_RELAXED,__ATOMIC_RELAXED)) {
+                    out = cell.value;
+                    __atomic_store_n(&cell.seq,pos+N,__ATOMIC_RELEASE);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = __atomic_load_n(&removePos,__ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    bool is_empty() const {
+        return addPos == removePos;
+    }
+};
+
+#endif
@@ -12,15 +12,19 @@ extern "C" void outl(int port, int val);
 
 extern "C" uint64_t rdmsr(uint32_t id);
 extern "C" void wrmsr(uint32_t id, uint64_t value);
+extern "C" uint64_t rdtsc();
 
 extern "C" void vmm_on(uint32_t pd);
 extern "C" void invlpg(uint32_t va);
 
 extern "C" void apitHandler_(void);
 extern "C" void spuriousHandler_(void);
+extern "C" void wakeupHandler_(void);
 extern "C" void pageFaultHandler_(void);
+extern "C" void nmHandler_(void);
 
 extern "C" void* memcpy(void *dest, const void* src, size_t n);
+extern "C" void* memset(void *dest, int value, size_t n);
 extern "C" void* bzero(void *dest, size_t n);
 
 extern "C" void sti();
@@ -29,6 +33,14 @@ extern "C" uint32_t getCR3();
 extern "C" uint32_t getFlags();
 extern "C" void monitor(uintptr_t);
 extern "C" void mwait();
+extern "C" void sti_hlt();
+extern "C" void sti_mwait();
+
+extern "C" void fpuInit();
+extern "C" void setTS();
+extern "C" void clts();
+extern "C" void fxsave(void* area);
+extern "C" void fxrstor(const void* area);
 
 struct cpuid_out {
     uint32_t a;
@@ -185,32 +185,33 @@ class Names_List {
         Debug::printf("End on contructor\n");
     }
 
-    void setSmallFile(Shared<File_Node> current, const char* name, Shared<Ext2> fs) {
+    void setSmallFile(Borrowed<File_Node> current, const char* name, Borrowed<Ext2> fs) {
         current->small = fs->find(fs->root,name); 
     }
 
-    void setBigFile(Shared<File_Node> current, const char* name, Shared<Ext2> fs) {
+    void setBigFile(Borrowed<File_Node> current, const char* name, Borrowed<Ext2> fs) {
         current->big = fs->find(fs->root,name); 
     }
 
-    void setWaveFile(Shared<File_Node> current, const char* name, Shared<Ext2> fs) {
+    void setWaveFile(Borrowed<File_Node> current, const char* name, Borrowed<Ext2> fs) {
 
         auto waveFile = fs->find(fs->root,name);
         Shared<WaveParser_list> returned_wave_file = Shared<WaveParser_list>::make(waveFile);
-        current->wave_file = returned_wave_file; 
+        current->wave_file = move(returned_wave_file); 
 
     }
 
-    void setPrev(Shared<File_Node> current, Shared<File_Node> prev) {
-        current->prev = prev; 
+    void setPrev(Borrowed<File_Node> current, Borrowed<File_Node> prev) {
+        current->prev = prev.share(); 
     }
 
-    void setNext(Shared<File_Node> current, Shared<File_Node> next) {
-        current->next = next; 
+    void setNext(Borrowed<File_Node> current, Borrowed<File_Node> next) {
+        current->next = next.share(); 
     }
 
-    void printList(Shared<File_Node> current) {
-        Shared<File_Node> temp = current; 
+    // the list holds on to its nodes, walking it doesn't have to
+    void printList(Borrowed<File_Node> current) {
+        Borrowed<File_Node> temp = current; 
         temp = temp->next;
         while(temp != current) {
             Debug::printf("Node Name: %s\n", temp->file_name);
@@ -218,14 +219,14 @@ class Names_List {
         }
     }
 
-    Shared<File_Node> findName(const char * name, Shared<File_Node> current) {
+    Shared<File_Node> findName(const char * name, Borrowed<File_Node> current) {
         Debug::printf("Finding Name: %s\n", name);
 
-        Shared<File_Node> temp = dummy->next; 
+        Borrowed<File_Node> temp = dummy->next; 
         while(temp != dummy) {
             if(K::streq(name, temp->file_name)) {
                 Debug::printf("YAY found it: %s\n", name);
-                return temp; 
+                return temp.share(); 
             }
             temp = temp->next; 
         }
@@ -234,7 +235,7 @@ class Names_List {
         return dummy;
     }
 
-    void resetFileSettings(Shared<File_Node> to_reset) {
+    void resetFileSettings(Borrowed<File_Node> to_reset) {
         to_reset->wave_file->offset = 0;
     }
 
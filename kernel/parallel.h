@@ -0,0 +1,77 @@
+#ifndef _parallel_h_
+#define _parallel_h_
+
+#include "stdint.h"
+#include "atomic.h"
+#include "config.h"
+#include "semaphore.h"
+#include "threads.h"
+
+// Fork-join. run() starts a closure on its own thread, wait() returns
+// once all of them are done. The threads land on idle cores (or get
+// stolen by them) so the work spreads over the machine. Only one thread
+// should call wait(), the group can be reused after it returns.
+//
+//    TaskGroup g;
+//    g.run([] { decodeArt(0); });
+//    g.run([] { decodeArt(1); });
+//    g.wait();
+//
+class TaskGroup {
+    Atomic<uint32_t> pending;       // one extra for the waiter
+    Semaphore allDone;
+public:
+    TaskGroup() : pending(1), allDone(0) {}
+    TaskGroup(const TaskGroup&) = delete;
+
+    template <typename F>
+    void run(F f) {
+        pending.add_fetch(1);
+        thread([this, f] {
+            f();
+            if (pending.add_fetch(-1) == 0) allDone.up();
+        });
+    }
+
+    void wait() {
+        if (pending.add_fetch(-1) != 0) allDone.down();
+        pending.set(1);
+    }
+};
+
+// Calls fn(lo, hi) for consecutive pieces of [begin, end) of about
+// "grain" iterations each, in parallel, and returns when all of them are
+// done. The caller works too. Pieces are handed out one at a time from a
+// shared counter so uneven pieces balance out.
+//
+// "workers" caps the number of threads working on it (the caller
+// included), 0 means one per core.
+template <typename F>
+void parallel_for(uint32_t begin, uint32_t end, uint32_t grain, const F& fn, uint32_t workers = 0) {
+    if (end <= begin) return;
+    if (grain == 0) grain = 1;
+
+    const uint32_t nPieces = (end - begin + grain - 1) / grain;
+    if ((workers == 0) || (workers > kConfig.totalProcs)) workers = kConfig.totalProcs;
+    if (workers > nPieces) workers = nPieces;
+
+    Atomic<uint32_t> nextPiece{0};
+    auto work = [&nextPiece, &fn, nPieces, begin, end, grain] {
+        while (true) {
+            auto piece = nextPiece.fetch_add(1);
+            if (piece >= nPieces) return;
+            auto lo = begin + piece * grain;
+            auto hi = (end - lo > grain) ? lo + grain : end;
+            fn(lo, hi);
+        }
+    };
+
+    TaskGroup g;
+    for (uint32_t i=1; i<workers; i++) {
+        g.run(work);
+    }
+    work();
+    g.wait();
+}
+
+#endif
@@ -4,63 +4,244 @@
 #include "debug.h"
 #include "atomic.h"
 #include "idt.h"
+#include "semaphore.h"
+#include "threads.h"
 
 namespace PhysMem {
 
-    static InterruptSafeLock lock{};
+    static InterruptSafeTicketLock lock{};
+    static LockStats lockStats{"physmem"};
 
-    struct Frame {
-        Frame* next;
+    // lives in the first frame of a free block
+    struct Block {
+        Block* next;
+        Block* prev;
     };
 
-    static Frame* firstFree = nullptr;
-    static uint32_t avail;
+    // a byte per frame from origin to limit: FREE | order for the first
+    // frame of a free block, 0 for everything else
+    constexpr uint8_t FREE = 0x80;
+
+    static Block* freeList[MAX_ORDER + 1];
+    static uint8_t* state = nullptr;
+    static uint32_t origin;         // start, rounded down to a 2^MAX_ORDER frame boundary
+    static uint32_t avail;          // first frame we manage
     static uint32_t limit;
+    static uint32_t freeCount = 0;
+
+    // Frames that are already zero, filled by the zeroing thread when it
+    // gets to run. Taken out of the buddy lists, so they don't merge.
+    constexpr uint32_t POOL_FRAMES = 256;
+    static uint32_t pool[POOL_FRAMES];
+    static uint32_t pooled = 0;
+    static bool refilling = false;
+    static Semaphore refill{0};
+
+    static inline uint32_t blockBytes(uint32_t order) {
+        return FRAME_SIZE << order;
+    }
 
-    uint32_t alloc_frame() {
-        LockGuard g{lock};
+    static inline uint8_t& stateOf(uint32_t pa) {
+        return state[(pa - origin) >> 12];
+    }
 
-        uint32_t p;
+    // all of these with the lock held
+
+    static void push(uint32_t pa, uint32_t order) {
+        auto b = (Block*) pa;
+        auto& head = freeList[order];
+        b->next = head;
+        b->prev = nullptr;
+        if (head != nullptr) head->prev = b;
+        head = b;
+        stateOf(pa) = FREE | order;
+        freeCount += 1 << order;
+    }
+
+    static void remove(uint32_t pa, uint32_t order) {
+        auto b = (Block*) pa;
+        if (b->prev != nullptr) b->prev->next = b->next; else freeList[order] = b->next;
+        if (b->next != nullptr) b->next->prev = b->prev;
+        stateOf(pa) = 0;
+        freeCount -= 1 << order;
+    }
 
-        if (firstFree != nullptr) {
-            p = (uint32_t) firstFree;
-            firstFree = firstFree->next;
-        } else {
-            if (avail == limit) {
-                Debug::panic("no more frames");
+    static uint32_t take(uint32_t order) {
+        uint32_t o = order;
+        while (freeList[o] == nullptr) {
+            o++;
+            if (o > MAX_ORDER) return 0;
+        }
+        auto pa = (uint32_t) freeList[o];
+        remove(pa, o);
+        // put back the halves we don't need
+        while (o > order) {
+            o--;
+            push(pa + blockBytes(o), o);
+        }
+        return pa;
+    }
+
+    static void give(uint32_t pa, uint32_t order) {
+        while (order < MAX_ORDER) {
+            auto buddy = origin + ((pa - origin) ^ blockBytes(order));
+            if (buddy < avail || buddy + blockBytes(order) > limit) break;
+            if (stateOf(buddy) != (FREE | order)) break;
+            remove(buddy, order);
+            if (buddy < pa) pa = buddy;
+            order++;
+        }
+        push(pa, order);
+    }
+
+    // [pa, pa + n frames) as the biggest aligned blocks that fit
+    static void giveRange(uint32_t pa, uint32_t n) {
+        auto end = pa + n * FRAME_SIZE;
+        while (pa < end) {
+            uint32_t order = MAX_ORDER;
+            while (((pa - origin) & (blockBytes(order) - 1)) != 0 || pa + blockBytes(order) > end) {
+                order--;
+            }
+            give(pa, order);
+            pa += blockBytes(order);
+        }
+    }
+
+    static inline uint32_t orderFor(uint32_t n) {
+        uint32_t order = 0;
+        while ((1u << order) < n) order++;
+        return order;
+    }
+
+    // lock held
+    static void flushPool() {
+        while (pooled != 0) {
+            give(pool[--pooled], 0);
+        }
+    }
+
+    uint32_t alloc_frame(Fill fill) {
+        uint32_t p = 0;
+        bool wake = false;
+        {
+            LockGuard g{lock};
+            if (fill == Fill::Zero && pooled != 0) {
+                p = pool[--pooled];
+                fill = Fill::None;
+            } else {
+                p = take(0);
+                if (p == 0 && pooled != 0) {
+                    p = pool[--pooled];
+                    fill = Fill::None;
+                }
+            }
+            if (pooled < POOL_FRAMES / 2 && !refilling) {
+                refilling = true;
+                wake = true;
             }
-            p = avail;
-            avail += FRAME_SIZE;
+        }
+        if (wake) refill.up();
+
+        if (p == 0) {
+            Debug::panic("no more frames");
         }
 
         ASSERT(offset(p) == 0);
 
-        bzero((void*)p,FRAME_SIZE);
+        if (fill == Fill::Zero) {
+            bzero((void*)p,FRAME_SIZE);
+        }
 
         return p;
     }
 
     void dealloc_frame(uint32_t p) {
+        ASSERT(offset(p) == 0);
+        ASSERT(p >= avail && p < limit);
+
         LockGuard g{lock};
+        give(p, 0);
+    }
 
-        ASSERT(offset(p) == 0);
+    uint32_t alloc_contiguous(uint32_t n) {
+        if (n == 0 || n > (1u << MAX_ORDER)) return 0;
+        auto order = orderFor(n);
+
+        LockGuard g{lock};
+        auto p = take(order);
+        if (p == 0 && pooled != 0) {
+            // the pool may be holding the buddies we need
+            flushPool();
+            p = take(order);
+        }
+        if (p != 0 && n < (1u << order)) {
+            // the tail past n frames goes back
+            giveRange(p + n * FRAME_SIZE, (1 << order) - n);
+        }
+        return p;
+    }
 
-        Frame* f = (Frame*) p;    
-        f->next = firstFree;
-        firstFree = f;
+    void dealloc_contiguous(uint32_t pa, uint32_t n) {
+        ASSERT(offset(pa) == 0);
+        ASSERT(pa >= avail && pa + n * FRAME_SIZE <= limit);
+
+        LockGuard g{lock};
+        giveRange(pa, n);
     }
 
+    uint32_t free_frames() {
+        return __atomic_load_n(&freeCount, __ATOMIC_RELAXED) + __atomic_load_n(&pooled, __ATOMIC_RELAXED);
+    }
 
     void init(uint32_t start, uint32_t size) {
         ASSERT(offset(start) == 0);
         ASSERT(offset(size) == 0);
         Debug::printf("| physical range 0x%x 0x%x\n",start,start+size);
+        origin = start & ~(blockBytes(MAX_ORDER) - 1);
         avail = start;
         limit = start + size;
 
+        auto frames = (limit - origin) >> 12;
+        state = new uint8_t[frames];
+        bzero(state, frames);
+
+        giveRange(avail, size / FRAME_SIZE);
+        Debug::printf("| %d free frames\n",freeCount);
+
+        lock.track(&lockStats);
+
         /* register the page fault handler */
         IDT::trap(14,(uint32_t)pageFaultHandler_,3);
     }
-    
-};
 
+    void startZeroing() {
+        {
+            LockGuard g{lock};
+            refilling = true;
+        }
+        refill.up();
+
+        thread([] {
+            setPriority(Priority::Low);
+            while (true) {
+                refill.down();
+                while (true) {
+                    uint32_t p;
+                    {
+                        LockGuard g{lock};
+                        if (pooled >= POOL_FRAMES) p = 0; else p = take(0);
+                        if (p == 0) {
+                            refilling = false;
+                            break;
+                        }
+                    }
+                    bzero((void*)p,FRAME_SIZE);
+                    // only we add to the pool, there is still room
+                    LockGuard g{lock};
+                    pool[pooled++] = p;
+                }
+            }
+        });
+    }
+
+};
@@ -3,11 +3,21 @@
 
 #include "stdint.h"
 
+// Physical frames, managed by a buddy allocator.
+//
+// Free memory is kept as blocks of 2^order frames (order 0 to MAX_ORDER),
+// each aligned to its own size. An allocation splits the smallest block
+// that fits, a free merges a block with its buddy for as long as the
+// buddy is free too.
 namespace PhysMem {
     constexpr uint32_t FRAME_SIZE = 1 << 12;
+    constexpr uint32_t MAX_ORDER = 11;          // 8MB
 
     void init(uint32_t start, uint32_t size);
 
+    // starts the thread that keeps the zeroed pool topped up
+    void startZeroing();
+
     inline uint32_t offset(uint32_t pa) {
         return pa & 0xFFF;
     }
@@ -24,9 +34,28 @@ namespace PhysMem {
         return framedown(pa + FRAME_SIZE - 1);
     }
 
-    uint32_t alloc_frame();
+    // What a new frame has in it. Fill::None is for buffers the caller is
+    // going to write all of anyway (DMA targets, file reads).
+    enum class Fill { Zero, None };
+
+    // one frame, panics if there are none left. Zeroed frames come from a
+    // pool a low priority thread fills ahead of time, so neither kind
+    // writes 4K on the way out unless the pool has run dry.
+    uint32_t alloc_frame(Fill fill = Fill::Zero);
 
     void dealloc_frame(uint32_t);
+
+    // n physically contiguous frames, not zeroed. The first one is aligned
+    // to n rounded up to a power of 2 (frames). 0 if there is no such run
+    // or n is more than 2^MAX_ORDER.
+    uint32_t alloc_contiguous(uint32_t n);
+
+    // gives back n frames starting at pa, any n and pa that are whole
+    // frames we handed out
+    void dealloc_contiguous(uint32_t pa, uint32_t n);
+
+    // frames nobody has, counting the zeroed pool
+    uint32_t free_frames();
 }
 
 #endif
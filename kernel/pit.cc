@@ -4,12 +4,10 @@
 #include "idt.h"
 #include "smp.h"
 #include "threads.h"
+#include "timer.h"
+#include "softirq.h"
 
 
-// TODO: WTF IS THIS 
-constexpr double PI = 3.14159265358979323846;
-int position = 0;
-
 /* The standard frequency of the PIT */
 constexpr uint32_t PIT_FREQ = 1193182;
 
@@ -20,6 +18,26 @@ uint32_t Pit::jiffiesPerSecond = 0;
 uint32_t Pit::apitCounter = 0;
 volatile uint32_t Pit::jiffies = 0;
 
+/*
+ * Tickless idle.
+ *
+ * Only cores with something to run keep their periodic tick. One of
+ * them is the timekeeper: it counts jiffies and runs the timer wheel.
+ * A timekeeper that goes idle hands the job to another ticking core.
+ * The last core to go idle keeps it and programs a one-shot interrupt
+ * for the next timer deadline instead, then catches up on the jiffies
+ * it slept through when it wakes up.
+ */
+static SpinLock tickLock{};
+static uint32_t ticking = 0;                // cores running a periodic tick
+static volatile uint32_t timekeeper = 0;
+static volatile bool keeperAsleep = false;  // the timekeeper is on a one-shot
+static uint32_t oneShotCount = 0;
+
+/* The longest we sleep without looking at the clock. Bounds how many
+ * jiffies we have to catch up on with interrupts disabled */
+constexpr uint32_t MAX_IDLE_MS = 100;
+
 struct PitInfo {
 };
 
@@ -98,6 +116,9 @@ void Pit::init() {
 
     SMP::apit_divide.set(0x0000000B); // divide by 1
 
+    LockGuard g{tickLock};
+    ticking |= 1 << SMP::me();
+
     // The following line will enable timer interrupts for this CPU
     // You better be prepared for it
     SMP::apit_lvt_timer.set(
@@ -110,44 +131,97 @@ void Pit::init() {
     SMP::apit_initial_count.set(apitCounter);
 }
 
+void Pit::stopTick() {
+    auto me = SMP::me();
+    LockGuard g{tickLock};
+
+    ticking &= ~(1 << me);
+
+    if (me == timekeeper) {
+        if (ticking != 0) {
+            timekeeper = __builtin_ctz(ticking);
+        } else {
+            // Nobody left to count for us. Sleep until the next timer
+            // is due.
+            auto delta = msToJiffies(MAX_IDLE_MS);
+            uint32_t deadline;
+            if (TimerWheel::next(deadline)) {
+                auto left = int32_t(deadline - jiffies);
+                if (left <= 1) {
+                    // Something runs every jiffy (the speaker). Keep the
+                    // periodic tick, reprogramming it each time would
+                    // make the jiffies drift
+                    ticking |= 1 << me;
+                    return;
+                }
+                if (uint32_t(left) < delta) delta = left;
+            }
+            oneShotCount = delta * apitCounter;
+            keeperAsleep = true;
+            SMP::apit_lvt_timer.set(
+                (0 << 17) |      // Timer mode: 0 -> One-shot
+                0 << 16   |      // mask: 0 -> interrupts not masked
+                APIT_vector
+            );
+            SMP::apit_initial_count.set(oneShotCount);
+            return;
+        }
+    }
+
+    // no tick at all, whoever gives us work will wake us up
+    SMP::apit_lvt_timer.set((1 << 16) | APIT_vector);
+    SMP::apit_initial_count.set(0);
+}
 
+void Pit::startTick() {
+    auto me = SMP::me();
+    uint32_t missed = 0;
+
+    {
+        LockGuard g{tickLock};
+
+        if (keeperAsleep) {
+            if (me == timekeeper) {
+                missed = (oneShotCount - SMP::apit_current_count.get()) / apitCounter;
+                keeperAsleep = false;
+            } else {
+                // jiffies stopped moving, the timekeeper has to catch up
+                SMP::wakeup(timekeeper);
+            }
+        }
 
+        if ((ticking & (1 << me)) == 0) {
+            ticking |= 1 << me;
+            SMP::apit_lvt_timer.set(
+                (1 << 17) |      // Timer mode: 1 -> Periodic
+                0 << 16   |      // mask: 0 -> interrupts not masked
+                APIT_vector
+            );
+            SMP::apit_initial_count.set(apitCounter);
+        }
+    }
 
-double sin(double x) {
-  double sum = 0.0;
-  double term = x;
-  double numerator = x;
-  double denominator = 1.0;
-  int sign = 1;
-  for (int i = 0; i < 10; i++) { // compute 10 terms of the Taylor series
-    sum += sign * term;
-    numerator *= x * x;
-    denominator *= (2 * i + 2) * (2 * i + 3);
-    term = numerator / denominator;
-    sign = -sign;
-  }
-  return sum;
+    // we lose the fraction of a jiffy we were in when we woke up
+    for (uint32_t i=0; i<missed; i++) {
+        jiffies ++;
+        TimerWheel::tick(jiffies);
+    }
 }
 
 
 extern "C" void apitHandler(uint32_t* things) {
+  Softirq::enter();
   auto id = SMP::me();
-  if (id == 0) {
+  if ((id == timekeeper) && !keeperAsleep) {
     Pit::jiffies ++;
+    TimerWheel::tick(Pit::jiffies);
   }
   SMP::eoi_reg.set(0);
+  Softirq::exit();
   auto me = gheith::activeThreads[id];
-  if ((me == nullptr) || (me->isIdle) || (me->saveArea.no_preempt)) return;
-
-  // update the speaker position with a sine wave
-  constexpr int frequency = 440;
-  constexpr int amplitude = 127;
-  constexpr int sampleRate = 44100;
-  const double phase = 2.0 * PI * frequency / sampleRate;
-  const int sample = static_cast<int>(amplitude * sin(position * phase));
-  position = (position + 1) % sampleRate;
-  outb(0x61, sample | 0x3); // set speaker position and turn speaker on
-
+  auto preempting = (me != nullptr) && !me->isIdle && !me->saveArea.no_preempt;
+  gheith::sampleTick(id, preempting);
+  if (!preempting) return;
   yield();
 }
 
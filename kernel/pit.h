@@ -15,9 +15,18 @@ public:
     volatile static uint32_t jiffies;
     static void calibrate(uint32_t hz);
     static void init();
+
+    // Tickless idle. Both are called by the idle thread with interrupts
+    // disabled, around the time it spends waiting for work.
+    static void stopTick();
+    static void startTick();
     static uint32_t secondsToJiffies(uint32_t secs) {
         return jiffiesPerSecond * secs;
     }
+    // rounds up so that waiting for the result is never too short
+    static uint32_t msToJiffies(uint32_t ms) {
+        return ms * (jiffiesPerSecond / 1000) + (ms * (jiffiesPerSecond % 1000) + 999) / 1000;
+    }
     static uint32_t seconds(void) {
         return jiffies / jiffiesPerSecond;
         return 0;
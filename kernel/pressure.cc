@@ -0,0 +1,110 @@
+#include "pressure.h"
+#include "blocking_lock.h"
+#include "config.h"
+#include "debug.h"
+#include "pit.h"
+
+void Shrinker::useful() {
+    // called on every hit from every core, only write the line when the
+    // value changes so readers can keep it shared
+    auto now = Pit::jiffies;
+    if (lastUseful != now) lastUseful = now;
+}
+
+namespace Pressure {
+
+    static Shrinker* first = nullptr;
+    static uint32_t theBudget = 0;
+    // shrinkers don't allocate, so nothing comes back in here while we
+    // hold it
+    static BlockingLock lock{};
+
+    void add(Shrinker* s) {
+        LockGuard g{lock};
+        s->lastUseful = Pit::jiffies;
+        s->next = first;
+        first = s;
+    }
+
+    void remove(Shrinker* s) {
+        LockGuard g{lock};
+        for (auto p = &first; *p != nullptr; p = &(*p)->next) {
+            if (*p == s) {
+                *p = s->next;
+                return;
+            }
+        }
+    }
+
+    uint32_t budget() {
+        if (theBudget == 0) theBudget = kConfig.memSize / 2;
+        return theBudget;
+    }
+
+    void setBudget(uint32_t bytes) {
+        theBudget = bytes;
+    }
+
+    constexpr uint32_t MAX_SHRINKERS = 32;
+
+    // lock held. Least recently useful first, until "bytes" are back
+    static uint32_t shrinkOldest(uint32_t bytes) {
+        Shrinker* order[MAX_SHRINKERS];
+        uint32_t n = 0;
+        uint32_t now = Pit::jiffies;
+        for (auto s = first; (s != nullptr) && (n < MAX_SHRINKERS); s = s->next) {
+            // by age, so the jiffies can wrap
+            auto age = now - s->lastUseful;
+            uint32_t i = n++;
+            while ((i > 0) && (now - order[i-1]->lastUseful < age)) {
+                order[i] = order[i-1];
+                i--;
+            }
+            order[i] = s;
+        }
+
+        uint32_t freed = 0;
+        for (uint32_t i=0; (i<n) && (freed < bytes); i++) {
+            auto s = order[i];
+            if (s->size() == 0) continue;
+            auto got = s->shrink(bytes - freed);
+            if (got != 0) {
+                s->shrinks ++;
+                s->shrunkBytes += got;
+                freed += got;
+            }
+        }
+        return freed;
+    }
+
+    void grew(Shrinker* s) {
+        LockGuard g{lock};
+        auto mine = s->size();
+        if (mine > s->peakBytes) s->peakBytes = mine;
+
+        uint32_t total = 0;
+        for (auto p = first; p != nullptr; p = p->next) {
+            total += p->size();
+        }
+        if (total > budget()) {
+            shrinkOldest(total - budget());
+        }
+    }
+
+    uint32_t relieve(uint32_t bytes) {
+        LockGuard g{lock};
+        return shrinkOldest(bytes);
+    }
+
+    void report() {
+        LockGuard g{lock};
+        uint32_t total = 0;
+        for (auto s = first; s != nullptr; s = s->next) {
+            auto bytes = s->size();
+            total += bytes;
+            Debug::printf("| caches: %s %u bytes, %u at most, shrunk %u times by %u\n",
+                s->name, bytes, s->peakBytes, s->shrinks, s->shrunkBytes);
+        }
+        Debug::printf("| caches: %u bytes of %u\n", total, budget());
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef _pressure_h_
+#define _pressure_h_
+
+#include "stdint.h"
+
+// Something holding memory it can do without, a cache for example.
+//
+// Caches register here instead of picking a size on their own. All of
+// them together get a budget, a share of kConfig.memSize. A cache that
+// grew calls Pressure::grew(), and if that puts the total over budget
+// the caches that were useful the longest time ago are shrunk first
+// until it fits again. When the heap can't find room for an allocation,
+// even after asking PhysMem for more, it does the same (relieve) and
+// tries once more before it fails.
+//
+// size() and shrink() run in whatever thread grew a cache or ran out of
+// memory, maybe with that thread's locks held, including the cache's
+// own. They must not allocate and must not wait for a lock, skip what
+// can't be had (try_lock).
+class Shrinker {
+public:
+    const char* const name;
+    Shrinker* next = nullptr;
+
+    // Pressure's, under its lock
+    uint32_t shrinks = 0;
+    uint32_t shrunkBytes = 0;
+    uint32_t peakBytes = 0;
+
+    // jiffies, see useful()
+    volatile uint32_t lastUseful = 0;
+
+    explicit Shrinker(const char* name) : name(name) {}
+
+    // bytes held right now, keep it cheap
+    virtual uint32_t size() = 0;
+
+    // give back about "bytes", returns how many it actually freed
+    virtual uint32_t shrink(uint32_t bytes) = 0;
+
+    // a hit, or whatever else says the memory was worth keeping
+    void useful();
+};
+
+namespace Pressure {
+    void add(Shrinker* s);
+    void remove(Shrinker* s);
+
+    // what all the shrinkers may hold together, half of memory unless
+    // somebody says otherwise
+    uint32_t budget();
+    void setBudget(uint32_t bytes);
+
+    // s holds more than before, shrinks the least recently useful
+    // caches if they are over budget now
+    void grew(Shrinker* s);
+
+    // shrinks the least recently useful caches until "bytes" are back,
+    // returns what they freed altogether
+    uint32_t relieve(uint32_t bytes);
+
+    // sizes and shrink counts for every cache, on the console
+    void report();
+}
+
+#endif
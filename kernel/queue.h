@@ -20,6 +20,12 @@ public:
         monitor((uintptr_t)&first);
     }
 
+    // Unlocked peek, can be stale. Lets callers skip taking the lock
+    // when there is obviously nothing to remove.
+    bool is_empty() const {
+        return first == nullptr;
+    }
+
     void add(T* t) {
         LockGuard g{lock};
         t->next = nullptr;
@@ -44,6 +50,33 @@ public:
         return it;
     }
 
+    // Takes out the first entry that satisfies pred, O(n)
+    template <typename Pred>
+    T* remove_if(const Pred& pred) {
+        LockGuard g{lock};
+        T* prev = nullptr;
+        for (T* it = first; it != nullptr; it = it->next) {
+            if (pred(it)) {
+                if (prev == nullptr) {
+                    first = it->next;
+                } else {
+                    prev->next = it->next;
+                }
+                if (last == it) {
+                    last = prev;
+                }
+                return it;
+            }
+            prev = it;
+        }
+        return nullptr;
+    }
+
+    // Takes t out from wherever it is, O(n). Returns false if it wasn't here
+    bool erase(T* t) {
+        return remove_if([t](T* it) { return it == t; }) != nullptr;
+    }
+
     T* remove_all() {
         LockGuard g{lock};
         auto it = first;
@@ -53,4 +86,79 @@ public:
     }
 };
 
+// One FIFO per priority level under a single lock. T needs a "priority"
+// member in [0,N). remove() hands out the highest priority first.
+template <typename T, typename LockType, uint32_t N>
+class PriorityQueue {
+    Queue<T,NoLock> levels[N];
+    LockType lock;
+    volatile uint32_t n = 0;
+public:
+    PriorityQueue() : levels(), lock() {}
+    PriorityQueue(const PriorityQueue&) = delete;
+
+    // The levels are small and adjacent, keep N low enough for them to
+    // share the monitored line.
+    void monitor_add() {
+        levels[0].monitor_add();
+    }
+
+    // see LockStats
+    void track(LockStats* stats) {
+        lock.track(stats);
+    }
+
+    bool is_empty() const {
+        for (uint32_t p=0; p<N; p++) {
+            if (!levels[p].is_empty()) return false;
+        }
+        return true;
+    }
+
+    // Unlocked, can be stale
+    uint32_t size() const {
+        return n;
+    }
+
+    void add(T* t) {
+        LockGuard g{lock};
+        levels[t->priority].add(t);
+        n = n + 1;
+    }
+
+    // highest priority entry that is at least "min", FIFO within a level
+    T* remove(uint32_t min = 0) {
+        LockGuard g{lock};
+        for (uint32_t p=N; p>min; p--) {
+            auto it = levels[p-1].remove();
+            if (it != nullptr) {
+                n = n - 1;
+                return it;
+            }
+        }
+        return nullptr;
+    }
+
+    // like remove() but skips the entries pred says no to
+    template <typename Pred>
+    T* remove_if(uint32_t min, const Pred& pred) {
+        LockGuard g{lock};
+        for (uint32_t p=N; p>min; p--) {
+            auto it = levels[p-1].remove_if(pred);
+            if (it != nullptr) {
+                n = n - 1;
+                return it;
+            }
+        }
+        return nullptr;
+    }
+
+    bool erase(T* t) {
+        LockGuard g{lock};
+        if (!levels[t->priority].erase(t)) return false;
+        n = n - 1;
+        return true;
+    }
+};
+
 #endif
@@ -0,0 +1,86 @@
+#ifndef _rwlock_h_
+#define _rwlock_h_
+
+#include "atomic.h"
+#include "threads.h"
+
+// Many readers or one writer, for data that is read a lot more than it
+// is written. Writers go first: once one is waiting, new readers hold
+// off so a steady stream of lookups can't starve an update.
+//
+// lock()/unlock() are the writer side so LockGuard works, readers use
+// lock_read()/unlock_read() or ReadGuard. Waiters spin for a little while
+// and then give the core to anybody that wants it (yieldToAll), keep the
+// critical sections short and don't do I/O in them.
+class RWLock {
+    static constexpr uint32_t WRITER = 1u << 31;
+    static constexpr uint32_t SPINS = 100;
+
+    Atomic<uint32_t> state;             // WRITER or the number of readers
+    Atomic<uint32_t> writersWaiting;
+
+    static void backoff(uint32_t& spins) {
+        if (spins < SPINS) {
+            spins ++;
+            pause();
+        } else {
+            // the holder could be a lower priority thread we preempted
+            yieldToAll();
+        }
+    }
+
+public:
+    RWLock() : state(0), writersWaiting(0) {}
+    RWLock(const RWLock&) = delete;
+
+    void lock_read() {
+        uint32_t spins = 0;
+        while (true) {
+            if (writersWaiting.get() == 0) {
+                auto s = state.get();
+                if (((s & WRITER) == 0) && state.compare_exchange(s, s + 1)) return;
+            }
+            backoff(spins);
+        }
+    }
+
+    void unlock_read() {
+        state.add_fetch(-1);
+    }
+
+    void lock() {
+        uint32_t spins = 0;
+        writersWaiting.add_fetch(1);
+        while (!state.compare_exchange(0, WRITER)) {
+            backoff(spins);
+        }
+        writersWaiting.add_fetch(-1);
+    }
+
+    void unlock() {
+        state.set(0);
+    }
+
+    // the writer side if nobody has the lock, without waiting
+    bool try_lock() {
+        return state.compare_exchange(0, WRITER);
+    }
+
+    // for debugging, etc. Allows false positives
+    bool isMine() {
+        return (state.get() & WRITER) != 0;
+    }
+};
+
+class ReadGuard {
+    RWLock& it;
+public:
+    inline ReadGuard(RWLock& it): it(it) {
+        it.lock_read();
+    }
+    inline ~ReadGuard() {
+        it.unlock_read();
+    }
+};
+
+#endif
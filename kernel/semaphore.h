@@ -5,11 +5,33 @@
 #include "atomic.h"
 #include "queue.h"
 #include "threads.h"
+#include "timer.h"
+#include "pit.h"
 
 class Semaphore {
+    // Wakes up a down(timeout_ms) that waited too long, unless up() beat it
+    struct WaitTimer : public Timer {
+        Semaphore* sem;
+        gheith::TCB* tcb = nullptr;
+        volatile bool timedOut = false;
+
+        WaitTimer(Semaphore* sem) : sem(sem) {}
+
+        void expired() override {
+            auto was = sem->lock.lock();
+            auto mine = sem->waiting.erase(tcb);
+            sem->lock.unlock(was);
+            if (mine) {
+                timedOut = true;
+                gheith::schedule(tcb);
+            }
+        }
+    };
+
     uint64_t volatile count;
     ISL lock;
-    Queue<gheith::TCB,NoLock> waiting;
+    // highest priority waiter gets woken up first
+    PriorityQueue<gheith::TCB,NoLock,Priority::COUNT> waiting;
 public:
     Atomic<uint32_t> ref_count;
     Semaphore(const uint32_t count) : count(count), lock(), waiting(), ref_count(0) {}
@@ -41,6 +63,43 @@ public:
         if (was) cli(); else sti();
     }
 
+    // Like down() but gives up after timeout_ms. Returns false if it did
+    bool down(uint32_t timeout_ms) {
+        using namespace gheith;
+
+        auto was = lock.lock();
+
+        if (count > 0) {
+            count--;
+            lock.unlock(was);
+            return true;
+        }
+
+        if (timeout_ms == 0) {
+            lock.unlock(was);
+            return false;
+        }
+
+        WaitTimer timer{this};
+        auto deadline = Pit::jiffies + Pit::msToJiffies(timeout_ms);
+
+        block(BlockOption::MustBlock,[this,&timer,deadline](TCB* me) {
+
+            ASSERT(!me->isIdle);
+
+            waiting.add(me);
+            timer.tcb = me;
+            TimerWheel::arm(&timer,deadline);
+            lock.unlock(true);
+        });
+
+        if (was) cli(); else sti();
+
+        // either up() or the timer woke us up, make sure the timer is done
+        TimerWheel::cancel(&timer);
+        return !timer.timedOut;
+    }
+
     void up() {
         using namespace gheith;
 
@@ -0,0 +1,36 @@
+#include "shared.h"
+#include "config.h"
+
+namespace gheith {
+    struct alignas(64) RefCounts {
+        uint32_t ups = 0;
+        uint32_t downs = 0;
+    };
+
+    static PerCPU<RefCounts> refCounts{};
+}
+
+// relaxed atomics so a thread that moves to another core in between
+// still counts right
+void RefStats::up() {
+    using namespace gheith;
+    __atomic_add_fetch(&refCounts.forCPU(SMP::meEarly()).ups, 1, __ATOMIC_RELAXED);
+}
+
+void RefStats::down() {
+    using namespace gheith;
+    __atomic_add_fetch(&refCounts.forCPU(SMP::meEarly()).downs, 1, __ATOMIC_RELAXED);
+}
+
+void RefStats::dump() {
+    using namespace gheith;
+    uint32_t ups = 0;
+    uint32_t downs = 0;
+    for (uint32_t i=0; i<kConfig.totalProcs; i++) {
+        auto& it = refCounts.forCPU(i);
+        Debug::printf("| refs: core %u %u up %u down\n", i, it.ups, it.downs);
+        ups += it.ups;
+        downs += it.downs;
+    }
+    Debug::printf("| refs: %u up %u down\n", ups, downs);
+}
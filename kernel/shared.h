@@ -101,16 +101,51 @@
 #include "debug.h"
 #include "smp.h"
 static ISL spin;
+
+// Reference count operations, built with -DREF_STATS. Counted per core,
+// so the counting doesn't add the cache line traffic it is there to
+// show. Defined in shared.cc
+class RefStats {
+public:
+    static void up();
+    static void down();
+    static void dump();
+};
+
+template <typename T>
+class Borrowed;
+
+// Reference counted pointer. The count lives in T (ref_count), so
+// make() is a single allocation. Every copy is an atomic operation on
+// a line other cores are probably using too: take Borrowed<T> for
+// parameters and move a Shared you are done with instead of copying it.
 template <typename T>
 class Shared {
     T* ptr;
 
+    friend class Borrowed<T>;
+
+    static inline void up(T* p) {
+#ifdef REF_STATS
+        RefStats::up();
+#endif
+        (p->ref_count).fetch_add(1);
+    }
+
+    static inline void down(T* p) {
+#ifdef REF_STATS
+        RefStats::down();
+#endif
+        if((p->ref_count).add_fetch(-1) == 0) {
+            delete p; 
+        }
+    }
 
 public:
 
     explicit Shared(T* it) : ptr(it) {
         if(it != nullptr) {
-            (ptr->ref_count).fetch_add(1);
+            up(ptr);
         }
     }
 
@@ -128,7 +163,7 @@ public:
     //
     Shared(const Shared& rhs): ptr(rhs.ptr) {
         if(rhs.ptr != nullptr) {
-            (ptr->ref_count).fetch_add(1);
+            up(ptr);
         }
     }
 
@@ -141,9 +176,7 @@ public:
 
     ~Shared() {
         if(ptr != nullptr) {
-            if((ptr->ref_count).add_fetch(-1) == 0) {
-                delete ptr; 
-            }
+            down(ptr);
         }
     }
 
@@ -164,14 +197,11 @@ public:
 
         ptr = rhs; 
         if(ptr != nullptr) {
-            (ptr->ref_count).fetch_add(1);
+            up(ptr);
         }
 
         if(holder != nullptr) {
-            T* temp = holder; 
-            if((holder->ref_count).add_fetch(-1) == 0) {
-                delete temp; 
-            }
+            down(holder);
         }
 
         return *this;
@@ -189,14 +219,11 @@ public:
 
         ptr = rhs.ptr; 
         if(ptr != nullptr) {
-            (ptr->ref_count).fetch_add(1);
+            up(ptr);
         }
 
         if(holder != nullptr) {
-            T* tempr = holder; 
-            if((holder->ref_count).add_fetch(-1) == 0) {
-                delete tempr; 
-            }
+            down(holder);
         }
 
         return *this;
@@ -216,10 +243,7 @@ public:
         rhs.ptr = nullptr;
 
         if(holder != nullptr) {
-            T* temp = holder; 
-            if((holder->ref_count).add_fetch(-1) == 0) {
-                delete temp; 
-            }
+            down(holder);
         }
 
         return *this;
@@ -242,11 +266,70 @@ public:
     }
 
     // e = Shared<Thing>::make(1,2,3);
+    // the arguments go to T's constructor as they are, no copies
     template <typename... Args>
-    static Shared<T> make(Args... args) {
-        return Shared<T>{new T(args...)};
+    static Shared<T> make(Args&&... args) {
+        return Shared<T>{new T(static_cast<Args&&>(args)...)};
+    }
+
+};
+
+// std::move for Shared, hands the reference over without touching the
+// count
+//
+//     current->wave_file = move(parser);
+//
+template <typename T>
+inline Shared<T>&& move(Shared<T>& it) {
+    return static_cast<Shared<T>&&>(it);
+}
+
+// A Shared<T> that somebody else holds, for parameters and for walking
+// structures that keep their nodes alive anyway. Making one from a
+// Shared costs nothing. The caller's Shared has to outlive it; share()
+// when you need to keep the object beyond that.
+//
+//     void show(Borrowed<File_Node> song);
+//     show(current);                      // no reference count traffic
+//
+template <typename T>
+class Borrowed {
+    T* ptr;
+
+public:
+    Borrowed(const Shared<T>& it) : ptr(it.ptr) {}
+
+    T* operator -> () const {
+        return ptr;
+    }
+
+    Shared<T> share() const {
+        return Shared<T>{ptr};
+    }
+
+    bool operator==(const Borrowed<T>& rhs) const {
+        return ptr == rhs.ptr;
+    }
+
+    bool operator!=(const Borrowed<T>& rhs) const {
+        return ptr != rhs.ptr;
+    }
+
+    bool operator==(const Shared<T>& rhs) const {
+        return ptr == rhs.ptr;
+    }
+
+    bool operator!=(const Shared<T>& rhs) const {
+        return ptr != rhs.ptr;
     }
 
+    bool operator==(T* rhs) const {
+        return ptr == rhs;
+    }
+
+    bool operator!=(T* rhs) const {
+        return ptr != rhs;
+    }
 };
 
-#endif
\ No newline at end of file
+#endif
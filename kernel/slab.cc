@@ -0,0 +1,256 @@
+#include "slab.h"
+#include "heap.h"
+#include "atomic.h"
+#include "machine.h"
+#include "smp.h"
+#include "debug.h"
+
+namespace gheith {
+
+    constexpr uint32_t PAGE_SHIFT = 12;
+    constexpr uint32_t PAGE = 1 << PAGE_SHIFT;
+    constexpr uint32_t SPAN = 32 * 1024;
+
+    constexpr uint32_t CLASS_BYTES[] = {
+        8, 16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024
+    };
+    constexpr uint32_t CLASSES = sizeof(CLASS_BYTES) / sizeof(CLASS_BYTES[0]);
+
+    static_assert(CLASS_BYTES[CLASSES - 1] == Slab::MAX_BYTES, "the last class has to be MAX_BYTES");
+
+    // blocks per magazine: about 8K worth, between 4 and 32
+    static constexpr uint32_t magazineSize(uint32_t c) {
+        return (8192 / CLASS_BYTES[c] > 32) ? 32 :
+               (8192 / CLASS_BYTES[c] < 4) ? 4 :
+               8192 / CLASS_BYTES[c];
+    }
+
+    // A free list of blocks linked through their first word
+    struct Magazine {
+        void* first = nullptr;
+        uint32_t count = 0;
+
+        inline void* pop() {
+            auto it = first;
+            first = *((void**) it);
+            count --;
+            return it;
+        }
+
+        inline void push(void* p) {
+            *((void**) p) = first;
+            first = p;
+            count ++;
+        }
+    };
+
+    // Full magazines are chained through the second word of their
+    // first block, every block has at least two
+    static inline void*& nextMagazine(void* head) {
+        return ((void**) head)[1];
+    }
+
+    struct Depot {
+        TicketLock lock{};
+        void* full = nullptr;           // magazines of magazineSize blocks
+        Magazine partial{};             // fewer, left over from carving spans
+        uint32_t spans = 0;
+
+        void give(Magazine& m) {
+            LockGuard g{lock};
+            nextMagazine(m.first) = full;
+            full = m.first;
+            m = Magazine{};
+        }
+
+        bool take(uint32_t c, Magazine& out) {
+            LockGuard g{lock};
+            if (full != nullptr) {
+                out.first = full;
+                out.count = magazineSize(c);
+                full = nextMagazine(full);
+                return true;
+            }
+            if (partial.count != 0) {
+                out = partial;
+                partial = Magazine{};
+                return true;
+            }
+            return false;
+        }
+    };
+
+    // Only touched by its own core, with interrupts disabled.
+    // "previous" is always either empty or full.
+    struct alignas(64) CoreCache {
+        Magazine loaded[CLASSES];
+        Magazine previous[CLASSES];
+    };
+
+    static PerCPU<CoreCache> caches{};
+    static Depot depots[CLASSES];
+
+    static uint8_t classOfSize[Slab::MAX_BYTES / 8 + 1];
+
+    // a byte per heap page: 0 if it isn't in a span, the class + 1 if it is
+    static uint8_t* pageClass = nullptr;
+    static uintptr_t heapStart = 0;
+    static uint32_t heapPages = 0;
+    static bool ready = false;
+
+    static inline void swap(Magazine& a, Magazine& b) {
+        auto t = a;
+        a = b;
+        b = t;
+    }
+
+    static inline CoreCache& myCache() {
+        return caches.forCPU(SMP::meEarly());
+    }
+
+    // interrupts disabled
+    static void* allocFast(uint32_t c) {
+        auto& cc = myCache();
+        auto& loaded = cc.loaded[c];
+        if (loaded.count == 0) {
+            auto& previous = cc.previous[c];
+            if (previous.count != 0) {
+                swap(loaded, previous);
+            } else if (!depots[c].take(c, loaded)) {
+                return nullptr;
+            }
+        }
+        return loaded.pop();
+    }
+
+    // interrupts disabled
+    static void freeFast(uint32_t c, void* p) {
+        auto& cc = myCache();
+        auto& loaded = cc.loaded[c];
+        if (loaded.count >= magazineSize(c)) {
+            auto& previous = cc.previous[c];
+            if (previous.count != 0) {
+                depots[c].give(previous);
+            }
+            swap(loaded, previous);
+        }
+        loaded.push(p);
+    }
+
+    // Carve a new span for class c into the depot. Can block on the heap
+    static bool grow(uint32_t c) {
+        auto raw = firstFitAlloc(SPAN + PAGE);
+        if (raw == nullptr) return false;
+
+        auto start = (uintptr_t(raw) + PAGE - 1) & ~uintptr_t(PAGE - 1);
+        auto firstPage = (start - heapStart) >> PAGE_SHIFT;
+        if (firstPage + SPAN / PAGE > heapPages) {
+            // outside the range we have pages for
+            firstFitFree(raw);
+            return false;
+        }
+
+        auto bytes = CLASS_BYTES[c];
+        auto m = magazineSize(c);
+        auto n = SPAN / bytes;
+
+        // full magazines, chained, before anyone can see them
+        void* full = nullptr;
+        void* last = nullptr;
+        Magazine mag{};
+        uint32_t i = 0;
+        for (; i + m <= n; i += m) {
+            for (uint32_t j=0; j<m; j++) {
+                mag.push((void*) (start + (i + j) * bytes));
+            }
+            nextMagazine(mag.first) = nullptr;
+            if (last == nullptr) full = mag.first; else nextMagazine(last) = mag.first;
+            last = mag.first;
+            mag = Magazine{};
+        }
+
+        for (uint32_t p=0; p<SPAN/PAGE; p++) {
+            pageClass[firstPage + p] = c + 1;
+        }
+
+        // the fast paths take the depot lock with interrupts disabled
+        Interrupts::protect([&] {
+            auto& depot = depots[c];
+            LockGuard g{depot.lock};
+            depot.spans ++;
+            if (last != nullptr) {
+                nextMagazine(last) = depot.full;
+                depot.full = full;
+            }
+            for (; i<n; i++) {
+                depot.partial.push((void*) (start + i * bytes));
+                if (depot.partial.count == m) {
+                    nextMagazine(depot.partial.first) = depot.full;
+                    depot.full = depot.partial.first;
+                    depot.partial = Magazine{};
+                }
+            }
+        });
+        return true;
+    }
+
+    static inline uint32_t classOf(void* p) {
+        return pageClass[(uintptr_t(p) - heapStart) >> PAGE_SHIFT] - 1;
+    }
+}
+
+void Slab::init(void* start, size_t bytes) {
+    using namespace gheith;
+
+    uint32_t c = 0;
+    for (uint32_t i=0; i<=MAX_BYTES/8; i++) {
+        while (CLASS_BYTES[c] < i * 8) c++;
+        classOfSize[i] = c;
+    }
+
+    heapStart = uintptr_t(start);
+    heapPages = (bytes + PAGE - 1) >> PAGE_SHIFT;
+    pageClass = (uint8_t*) firstFitAlloc(heapPages);
+    if (pageClass == nullptr) return;
+    bzero(pageClass, heapPages);
+
+    ready = true;
+}
+
+void* Slab::alloc(size_t bytes) {
+    using namespace gheith;
+    if (!ready || (bytes > MAX_BYTES)) return nullptr;
+
+    auto c = classOfSize[(bytes + 7) / 8];
+    while (true) {
+        void* p;
+        Interrupts::protect([&p, c] {
+            p = allocFast(c);
+        });
+        if (p != nullptr) return p;
+        if (!grow(c)) return nullptr;
+    }
+}
+
+bool Slab::owns(void* p) {
+    using namespace gheith;
+    auto page = (uintptr_t(p) - heapStart) >> PAGE_SHIFT;
+    return ready && (uintptr_t(p) >= heapStart) && (page < heapPages) && (pageClass[page] != 0);
+}
+
+void Slab::free(void* p) {
+    using namespace gheith;
+    auto c = classOf(p);
+    Interrupts::protect([c, p] {
+        freeFast(c, p);
+    });
+}
+
+uint32_t Slab::spanBytes() {
+    using namespace gheith;
+    uint32_t spans = 0;
+    for (uint32_t c=0; c<CLASSES; c++) {
+        spans += __atomic_load_n(&depots[c].spans, __ATOMIC_RELAXED);
+    }
+    return spans * SPAN;
+}
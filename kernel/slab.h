@@ -0,0 +1,35 @@
+#ifndef _slab_h_
+#define _slab_h_
+
+#include "stdint.h"
+
+// Size classes for the small blocks malloc hands out.
+//
+// Every class carves 32K spans, taken from the first-fit heap, into
+// blocks of one size. A table with a byte for every 4K page the heap
+// can grow into says which class a page belongs to, so free() finds the class of a
+// block without a header.
+//
+// Each core keeps two magazines (short free lists) per class and
+// allocates and frees with nothing but interrupts disabled. Only when
+// both are empty (or full) does it trade a whole magazine with the
+// class's depot, under a lock. Spans are never given back to the heap.
+class Slab {
+public:
+    static constexpr uint32_t MAX_BYTES = 1024;
+
+    // the range the heap can ever have memory in
+    static void init(void* heapStart, size_t heapBytes);
+
+    // nullptr if it's too big or no span can be had
+    static void* alloc(size_t bytes);
+
+    // does p belong to a span?
+    static bool owns(void* p);
+    static void free(void* p);
+
+    // memory in spans, used or not
+    static uint32_t spanBytes();
+};
+
+#endif
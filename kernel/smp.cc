@@ -2,6 +2,7 @@
 #include "machine.h"
 #include "debug.h"
 #include "idt.h"
+#include "softirq.h"
 
 AtomicPtr<uint32_t> SMP::id;
 AtomicPtr<uint32_t> SMP::eoi_reg;
@@ -14,6 +15,7 @@ AtomicPtr<uint32_t> SMP::apit_current_count;
 AtomicPtr<uint32_t> SMP::apit_divide;
 
 Atomic<uint32_t> SMP::running {0};
+volatile bool SMP::started = false;
 
 const char* SMP::names[] = {
     "cpu0",
@@ -46,10 +48,14 @@ void SMP::init(bool isFirst) {
         apit_initial_count = (uint32_t *) (kConfig.localAPIC + 0x380);
         apit_current_count = (uint32_t *) (kConfig.localAPIC + 0x390);
         apit_divide = (uint32_t *) (kConfig.localAPIC + 0x3e0);
+        started = true;
 
         // Register spurious interrupt handler
         IDT::interrupt(0xff, (uint32_t) spuriousHandler_);
 
+        // Register the wakeup IPI handler
+        IDT::interrupt(WAKEUP_vector, (uint32_t) wakeupHandler_);
+
     }
 
     // disable PIC
@@ -62,3 +68,17 @@ void SMP::init(bool isFirst) {
 
     spurious.set(0x1ff);
 }
+
+void SMP::wakeup(uint32_t id) {
+    // icr_low/icr_high is a two step dance, don't let an interrupt
+    // handler on this core start another one in the middle
+    Interrupts::protect([id] {
+        ipi(id, (1 << 14) | WAKEUP_vector); // fixed delivery, assert
+    });
+}
+
+extern "C" void wakeupHandler() {
+    Softirq::enter();
+    SMP::eoi_reg.set(0);
+    Softirq::exit();
+}
@@ -4,6 +4,7 @@
 #include "config.h"
 #include "stdint.h"
 #include "atomic.h"
+#include "debug.h"
 
 class SMP {
 private:
@@ -25,6 +26,9 @@ public:
 public:
     static void init(bool isFirst);
     static uint32_t me() { return (id.get() >> 24); }
+    // me() for code that also runs before init(), like the heap and the
+    // thread pools. Until then there is only the boot core
+    static uint32_t meEarly() { return started ? me() : 0; }
     static const char* name() { return names[me()]; }
     static void eoi() { eoi_reg = 0; }
 
@@ -34,7 +38,13 @@ public:
         while (icr_low.get() & (1 << 12));
     }
 
+    // An IPI that does nothing but interrupt the target, gets an idle
+    // core out of hlt/mwait
+    static constexpr uint32_t WAKEUP_vector = 41;
+    static void wakeup(uint32_t id);
+
     static Atomic<uint32_t> running;
+    static volatile bool started;
 };
 
 
@@ -44,6 +54,7 @@ private:
     T data[MAX_PROCS];
 public:
     inline T& forCPU(int id) {
+        ASSERT(uint32_t(id) < kConfig.totalProcs);
         return data[id];
     }
 
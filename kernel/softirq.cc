@@ -0,0 +1,178 @@
+#include "softirq.h"
+#include "machine.h"
+#include "debug.h"
+#include "config.h"
+#include "smp.h"
+#include "threads.h"
+#include "semaphore.h"
+#include "lockfree.h"
+
+namespace gheith {
+
+    struct alignas(64) SoftirqQueue {
+        MPSCQueue<Deferred> pending;
+        // Whoever is emptying "pending", the tail of an interrupt or the
+        // thread. MPSCQueue wants one consumer at a time.
+        volatile bool busy = false;
+        Semaphore wake{0};
+    };
+
+    static PerCPU<SoftirqQueue> softirqs{};
+
+    static inline void runOne(Deferred* d) {
+        // it can raise itself again from run()
+        __atomic_store_n(&d->queued, 0, __ATOMIC_RELEASE);
+        d->run();
+    }
+
+    // the softirq thread for core "id" (it could have been moved off it)
+    static void drain(uint32_t id) {
+        auto& q = softirqs.forCPU(id);
+        while (true) {
+            if (__atomic_exchange_n(&q.busy, true, __ATOMIC_ACQUIRE)) {
+                // the interrupt tail has it and it will wake us up again
+                return;
+            }
+            while (true) {
+                auto d = q.pending.remove();
+                if (d == nullptr) break;
+                auto was = current()->saveArea.no_preempt;
+                current()->saveArea.no_preempt = 1;
+                runOne(d);
+                current()->saveArea.no_preempt = was;
+            }
+            __atomic_store_n(&q.busy, false, __ATOMIC_RELEASE);
+
+            // A handler that raised after our last remove() saw "busy"
+            // and left it to us, without waking us up
+            if (q.pending.is_empty()) return;
+        }
+    }
+}
+
+bool Softirq::raise(Deferred* d) {
+    using namespace gheith;
+
+    if (__atomic_exchange_n(&d->queued, 1, __ATOMIC_ACQ_REL) != 0) return false;
+
+    auto was = Interrupts::disable();
+    auto& q = softirqs.mine();
+    q.pending.add(d);
+    if (!was) {
+        // Not from a handler, there is no exit() coming to pick it up
+        q.wake.up();
+    }
+    Interrupts::restore(was);
+    return true;
+}
+
+void Softirq::exit() {
+    using namespace gheith;
+
+#ifdef IRQ_STATS
+    IrqStats::on(__builtin_return_address(0));
+#endif
+
+    auto id = SMP::me();
+    auto& q = softirqs.forCPU(id);
+    auto me = (activeThreads == nullptr) ? nullptr : activeThreads[id];
+    if ((me == nullptr) || q.pending.is_empty()) return;
+    if (__atomic_exchange_n(&q.busy, true, __ATOMIC_ACQUIRE)) return;
+
+    // Nothing can move us off the core while we run the work, not even
+    // an APIT interrupt that would otherwise preempt the thread
+    auto was = me->saveArea.no_preempt;
+    me->saveArea.no_preempt = 1;
+    sti();
+
+    for (uint32_t n=0; n<MAX_INLINE; n++) {
+        auto d = q.pending.remove();
+        if (d == nullptr) break;
+        runOne(d);
+    }
+
+    cli();
+    me->saveArea.no_preempt = was;
+    __atomic_store_n(&q.busy, false, __ATOMIC_RELEASE);
+
+    if (!q.pending.is_empty()) {
+        q.wake.up();
+    }
+}
+
+void Softirq::init() {
+    using namespace gheith;
+
+    for (uint32_t i=0; i<kConfig.totalProcs; i++) {
+        thread([i] {
+            setAffinity(uint32_t(1) << i);
+            setPriority(Priority::High);
+            auto& q = softirqs.forCPU(i);
+            while (true) {
+                q.wake.down();
+                drain(i);
+            }
+        });
+    }
+
+#ifdef IRQ_STATS
+    IrqStats::start();
+#endif
+}
+
+/*
+ * Interrupts-off accounting. Every core only touches its own entry, with
+ * interrupts disabled.
+ */
+
+namespace gheith {
+    struct alignas(64) IrqOff {
+        uint64_t since = 0;
+        uint32_t max = 0;
+        const void* where = nullptr;
+        uint32_t windows = 0;
+        uint32_t over = 0;
+    };
+
+    static PerCPU<IrqOff> irqOff{};
+
+    // SMP::me() doesn't work until SMP::init
+    static volatile bool measuring = false;
+}
+
+void IrqStats::start() {
+    gheith::measuring = true;
+}
+
+void IrqStats::off() {
+    using namespace gheith;
+    if (!measuring) return;
+    irqOff.mine().since = rdtsc();
+}
+
+void IrqStats::on(const void* site) {
+    using namespace gheith;
+    if (!measuring) return;
+    auto& it = irqOff.mine();
+    if (it.since == 0) return;
+
+    auto held = rdtsc() - it.since;
+    it.since = 0;
+    it.windows ++;
+    auto cycles = (held >> 32) ? 0xffffffff : uint32_t(held);
+    if (cycles > LIMIT) it.over ++;
+    if (cycles > it.max) {
+        it.max = cycles;
+        it.where = site;
+    }
+}
+
+void IrqStats::dump() {
+    using namespace gheith;
+    Debug::printf("| irqoff: core windows over%u max(cycles) where\n", LIMIT);
+    for (uint32_t i=0; i<kConfig.totalProcs; i++) {
+        auto& it = irqOff.forCPU(i);
+        Debug::printf("| irqoff: %u %u %u %u 0x%x\n",
+            i, it.windows, it.over, it.max, (uint32_t) it.where);
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef _softirq_h_
+#define _softirq_h_
+
+#include "stdint.h"
+#include "atomic.h"
+
+// Work that an interrupt handler wants done, but not with interrupts
+// disabled. Intrusive like Timer: raising one never allocates, and a
+// Deferred is queued at most once no matter how often it is raised
+// before it runs.
+//
+// run() is called with interrupts enabled but with preemption off, on
+// the core that raised it or on that core's softirq thread. Don't block,
+// and don't take a lock that the interrupted code could be holding
+// (plain SpinLocks), same as in a handler.
+class Deferred {
+public:
+    Deferred* next = nullptr;
+    volatile uint32_t queued = 0;
+
+    virtual void run() = 0;
+};
+
+// Per-core queues of Deferred work (bottom halves).
+//
+// Handlers that go through enter()/exit() run up to MAX_INLINE items
+// on the way out of the interrupt, after the EOI and with interrupts
+// back on. Whatever is left over goes to a High priority thread pinned
+// to the core, so one busy source can't hold up the interrupted thread
+// for long either.
+class Softirq {
+public:
+    static constexpr uint32_t MAX_INLINE = 8;
+
+    // Queue d on the calling core. Fine from interrupt handlers. false
+    // if it was already queued
+    static bool raise(Deferred* d);
+
+    // first thing in an interrupt handler
+    static inline void enter() {
+#ifdef IRQ_STATS
+        IrqStats::off();
+#endif
+    }
+
+    // Last thing in an interrupt handler, after the EOI. Interrupts are
+    // disabled going in and coming out.
+    static void exit();
+
+    // Starts the softirq threads, once all cores are up. Until then
+    // leftovers wait for the next interrupt.
+    static void init();
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include "speaker.h"
+#include "machine.h"
+#include "debug.h"
+#include "pit.h"
+#include "timer.h"
+
+namespace gheith {
+
+    /* The PIT input clock, same as in pit.cc */
+    constexpr uint32_t PIT_FREQ = 1193182;
+
+    /* About 90ms worth of samples at 44.1KHz */
+    constexpr uint32_t RING = 4096;
+
+    // PIT count for each 8-bit sample level
+    static uint8_t levels[256];
+    static bool ready = false;
+
+    // single producer (write), single consumer (the sampler)
+    static uint8_t ring[RING];
+    static volatile uint32_t head = 0;
+    static volatile uint32_t tail = 0;
+
+    // resampling state carried from one write() to the next
+    static uint32_t frac = 0;
+    static uint32_t skip = 0;
+
+    static volatile bool on = false;
+
+    struct Sampler : public Timer {
+        void expired() override {
+            auto t = tail;
+            if (t != head) {
+                outb(0x42, ring[t & (RING - 1)]);
+                __atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+            } else {
+                // ran dry, hold the cone in the middle
+                outb(0x42, levels[128]);
+            }
+            if (on) TimerWheel::arm(this, expires + 1);
+        }
+    };
+
+    static Sampler sampler{};
+
+    static void setup() {
+        // PIT clocks in one sample period, 27 at 44.1KHz
+        auto period = PIT_FREQ / Pit::secondsToJiffies(1);
+        ASSERT(period >= 3);
+        if (period > 256) period = 256;
+
+        // Mode 0 keeps the output low for "count" clocks, louder
+        // samples get shorter counts. Never 0, that means 65536.
+        for (uint32_t i=0; i<256; i++) {
+            levels[i] = (period - 1) - i * (period - 2) / 255;
+        }
+
+        outb(0x43,0b10010000); //  10 -> channel#2
+                               //  01 -> lobyte only
+                               // 000 -> interrupt on terminal count
+                               //   0 -> count in binary
+        ready = true;
+    }
+
+    static void start() {
+        if (on) return;
+        on = true;
+        outb(0x61, inb(0x61) | 3);      // gate on, speaker on
+        TimerWheel::arm(&sampler, Pit::jiffies + 1);
+    }
+}
+
+void Speaker::write(const int16_t* pcm, uint32_t n, uint32_t rate) {
+    using namespace gheith;
+    ASSERT((rate > 0) && (rate < 65536));
+
+    if (!ready) setup();
+
+    // input samples per jiffy in 16.16 fixed point
+    auto step = (rate << 16) / Pit::secondsToJiffies(1);
+
+    uint32_t i = skip;
+    while (i < n) {
+        while (head - tail >= RING) {
+            start();
+            sleep_ms(10);
+        }
+        ring[head & (RING - 1)] = levels[uint8_t((pcm[i] >> 8) + 128)];
+        __atomic_store_n(&head, head + 1, __ATOMIC_RELEASE);
+
+        frac += step;
+        i += frac >> 16;
+        frac &= 0xffff;
+    }
+    skip = i - n;
+
+    start();
+}
+
+void Speaker::drain() {
+    using namespace gheith;
+    while (on && (tail != head)) {
+        sleep_ms(10);
+    }
+    stop();
+}
+
+void Speaker::stop() {
+    using namespace gheith;
+    if (!on) return;
+    on = false;
+
+    // also drops the re-arm if the sampler is running right now
+    TimerWheel::cancel(&sampler);
+
+    outb(0x61, inb(0x61) & ~3);
+    tail = head;
+    frac = 0;
+    skip = 0;
+}
+
+bool Speaker::playing() {
+    return gheith::on;
+}
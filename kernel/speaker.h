@@ -0,0 +1,36 @@
+#ifndef _speaker_h_
+#define _speaker_h_
+
+#include "stdint.h"
+
+// PCM audio on the PC speaker.
+//
+// The speaker cone is either in or out, levels in between come from
+// pulse-width modulation. PIT channel 2 runs as a one-shot (mode 0) whose
+// output drives the speaker: it goes low when we load a count and back
+// high when the count runs out. Reloading it once per sample period with
+// a count that depends on the sample sets how long the cone is out.
+//
+// The sample clock is the jiffy, a Timer on the wheel that fires every
+// jiffy while we're playing. write() converts samples to PIT counts
+// through a table and resamples to the jiffy rate, so all the timer
+// does is take a byte out of a ring buffer and write it to the PIT.
+//
+// Nothing touches channel 2 or port 0x61 before the first write().
+class Speaker {
+public:
+    // Queue signed 16-bit mono samples recorded at "rate" Hz (< 65536).
+    // Blocks while the buffer is full. One writer at a time.
+    static void write(const int16_t* pcm, uint32_t n, uint32_t rate);
+
+    // wait until everything queued has been played, then stop()
+    static void drain();
+
+    // Turn the speaker off right away, whatever is queued gets dropped.
+    // Same writer as write().
+    static void stop();
+
+    static bool playing();
+};
+
+#endif
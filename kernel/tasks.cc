@@ -0,0 +1,65 @@
+#include "tasks.h"
+#include "threads.h"
+
+bool Signal::add(Task* t) {
+    auto was = lock.lock();
+    if (fired) {
+        lock.unlock(was);
+        return false;
+    }
+    waiters.add(t);
+    lock.unlock(was);
+    return true;
+}
+
+void Signal::fire() {
+    auto was = lock.lock();
+    fired = true;
+    auto it = waiters.remove_all();
+    lock.unlock(was);
+
+    while (it != nullptr) {
+        auto next = it->next;
+        it->executor->wake(it);
+        it = next;
+    }
+}
+
+Executor::Executor(uint32_t nThreads) : ready(), nReady(0) {
+    for (uint32_t i=0; i<nThreads; i++) {
+        thread([this] {
+            while (true) {
+                nReady.down();
+                run(ready.remove());
+            }
+        });
+    }
+}
+
+void Executor::spawn(Task* t) {
+    t->executor = this;
+    wake(t);
+}
+
+void Executor::wake(Task* t) {
+    ready.add(t);
+    nReady.up();
+}
+
+void Executor::run(Task* t) {
+    switch (t->step()) {
+    case Task::Step::Done:
+        delete t;
+        break;
+    case Task::Step::Yield:
+        wake(t);
+        break;
+    case Task::Step::Waiting: {
+        // Only now that step() has returned can it be picked up again
+        auto s = t->waitingOn;
+        t->waitingOn = nullptr;
+        if (!s->add(t)) wake(t);
+        break;
+    }
+    }
+}
@@ -0,0 +1,126 @@
+#ifndef _tasks_h_
+#define _tasks_h_
+
+#include "stdint.h"
+#include "atomic.h"
+#include "queue.h"
+#include "semaphore.h"
+
+// Stackless tasks for I/O-bound work.
+//
+// A Task is a state machine. step() runs until the task is done or has
+// to wait for something and then returns. Anything it needs across a
+// wait lives in its members, not on a stack, so thousands of them can be
+// in flight on a few executor threads.
+//
+//    struct LoadArt : public Task {
+//        uint32_t state = 0;
+//        TaskFuture<char*> data;
+//
+//        Step step() override {
+//            switch (state) {
+//            case 0:
+//                startRead(&data);           // somebody calls data.set() later
+//                state = 1;
+//                return waitFor(&data);
+//            case 1:
+//                decode(data.get());
+//                return Step::Done;
+//            }
+//            return Step::Done;
+//        }
+//    };
+//
+//    executor->spawn(new LoadArt());
+//
+// step() is never called by two threads at once, but consecutive steps
+// can run on different threads and cores. Don't block in step(), hand
+// blocking work to a thread and wait for a TaskFuture instead.
+
+class Executor;
+class Signal;
+
+class Task {
+    friend class Executor;
+    friend class Signal;
+    Executor* executor = nullptr;
+    Signal* waitingOn = nullptr;
+public:
+    Task* next = nullptr;           // queue stuff
+
+    enum class Step {
+        Done,                       // the executor deletes the task
+        Waiting,                    // from waitFor()
+        Yield                       // run me again later
+    };
+
+    virtual ~Task() {}
+
+    virtual Step step() = 0;
+
+protected:
+    // Suspends the task until s fires. Has to be returned from step()
+    Step waitFor(Signal* s) {
+        waitingOn = s;
+        return Step::Waiting;
+    }
+};
+
+// Fires once. Tasks that wait for it after that keep going right away.
+class Signal {
+    friend class Executor;
+    ISL lock;
+    volatile bool fired;
+    Queue<Task,NoLock> waiters;
+
+    // false if it already fired
+    bool add(Task* t);
+public:
+    Signal() : lock(), fired(false), waiters() {}
+    Signal(const Signal&) = delete;
+
+    bool isSet() const { return fired; }
+
+    // Can be called from anywhere that can call schedule()
+    void fire();
+};
+
+// A value a task can wait for
+template <typename T>
+class TaskFuture : public Signal {
+    T volatile value;
+public:
+    TaskFuture() : Signal(), value() {}
+
+    void set(T v) {
+        ASSERT(!isSet());
+        value = v;
+        fire();
+    }
+
+    // only after it's set
+    T get() {
+        ASSERT(isSet());
+        return value;
+    }
+};
+
+// Runs tasks on a fixed set of threads. Like WorkerPool, it lives
+// forever.
+class Executor {
+    Queue<Task,InterruptSafeLock> ready;
+    Semaphore nReady;
+
+    void run(Task* t);
+public:
+    Executor(uint32_t nThreads);
+    Executor(const Executor&) = delete;
+
+    // takes ownership of t
+    void spawn(Task* t);
+
+    // t can run again
+    void wake(Task* t);
+};
+
+#endif
@@ -5,6 +5,8 @@
 #include "machine.h"
 #include "ext2.h"
 #include "threads.h"
+#include "pit.h"
+#include "arena.h"
 
 
 namespace gheith {
@@ -13,9 +15,43 @@ namespace gheith {
     TCB** activeThreads;
     TCB** idleThreads;
 
-    Queue<TCB,InterruptSafeLock> readyQ{};
+    PerCPU<ReadyQueue> readyQ{};
+
+    // How many RealTime threads are sitting in ready queues. Lets a core
+    // skip the search for them on every tick.
+    Atomic<uint32_t> realTimeReady{0};
     Queue<TCB,InterruptSafeLock> zombies{};
 
+    // Cores that are in idle(), schedule() sends work their way
+    static Atomic<uint32_t> idleCores{0};
+
+    // reservedBy[i] is the only thread that may run on core i, nullptr
+    // if the core is shared. "reserved" has a bit for every such core.
+    static TCB* volatile reservedBy[MAX_PROCS];
+    static Atomic<uint32_t> reserved{0};
+    static InterruptSafeLock reserveLock{};
+
+    static inline uint32_t allCores() {
+        return (uint32_t(1) << kConfig.totalProcs) - 1;
+    }
+
+    // where tcb can run right now
+    static uint32_t allowedCores(TCB* tcb) {
+        auto mask = tcb->affinity & allCores();
+        auto out = mask & ~reserved.get();
+        if (out == 0) {
+            // a core of its own?
+            for (uint32_t i=0; i<kConfig.totalProcs; i++) {
+                if (reservedBy[i] == tcb) out |= uint32_t(1) << i;
+            }
+        }
+        if (out == 0) {
+            // everything it asked for got reserved by others
+            out = allCores() & ~reserved.get();
+        }
+        return out;
+    }
+
     TCB* current() {
         auto was = Interrupts::disable();
         TCB* out = activeThreads[SMP::me()];
@@ -30,6 +66,42 @@ namespace gheith {
         stop();
     }
 
+    // Only ever written by its own core: in block() with preemption off
+    // or from the APIT handler
+    struct alignas(64) CoreStats {
+        SchedStats s;
+        uint64_t sliceStart;
+    };
+
+    static PerCPU<CoreStats> coreStats{};
+
+    // me is giving up the core, charge it for its slice
+    void account(uint32_t core_id, TCB* me) {
+        auto& cs = coreStats.forCPU(core_id);
+        auto now = rdtsc();
+        if (cs.sliceStart != 0) {
+            auto slice = now - cs.sliceStart;
+            me->cycles += slice;
+            if (me->isIdle) {
+                cs.s.idleCycles += slice;
+            } else {
+                cs.s.busyCycles += slice;
+            }
+        }
+        cs.sliceStart = now;
+        cs.s.switches ++;
+    }
+
+    // from the APIT handler, interrupts are disabled
+    void sampleTick(uint32_t core_id, bool preempting) {
+        auto& s = coreStats.forCPU(core_id).s;
+        auto len = readyQ.forCPU(core_id).size();
+        s.queueSamples ++;
+        s.queueTotal += len;
+        if (len > s.queueMax) s.queueMax = len;
+        if (preempting) s.preemptions ++;
+    }
+
     void delete_zombies() {
         while (true) {
             auto it = zombies.remove();
@@ -38,9 +110,199 @@ namespace gheith {
         }
     }
 
+    // Our own queue first, then steal from the others. We start with our
+    // neighbour so that several thieves don't all go after core 0. Only
+    // threads that are allowed on this core are taken, and a reserved
+    // core doesn't steal.
+    static TCB* take(uint32_t core_id, uint32_t min) {
+        auto mine = [core_id](TCB* tcb) {
+            return ((allowedCores(tcb) >> core_id) & 1) != 0;
+        };
+
+        auto& q = readyQ.forCPU(core_id);
+        q.drain();
+        auto it = q.remove_if(min, mine);
+        if (it != nullptr) return it;
+        if (reservedBy[core_id] != nullptr) return nullptr;
+
+        for (uint32_t i=1; i<kConfig.totalProcs; i++) {
+            auto& victim = readyQ.forCPU((core_id + i) % kConfig.totalProcs);
+            if (victim.is_empty()) continue;
+            it = victim.remove_if(min, mine);
+            if (it != nullptr) return it;
+        }
+        return nullptr;
+    }
+
+    // A RealTime thread on any core goes before whatever we have locally
+    TCB* next_ready(uint32_t core_id, uint32_t min) {
+        TCB* it = nullptr;
+        if (realTimeReady.get() != 0) {
+            it = take(core_id, Priority::RealTime);
+        }
+        if ((it == nullptr) && (min != Priority::RealTime)) {
+            it = take(core_id, min);
+        }
+        if ((it != nullptr) && (it->priority == Priority::RealTime)) {
+            realTimeReady.add_fetch(-1);
+        }
+        return it;
+    }
+
+    // Could take() find something? Can be wrong about threads that are
+    // pinned elsewhere, that only costs a trip around the idle loop.
+    static bool anything_ready(uint32_t core_id) {
+        auto& q = readyQ.forCPU(core_id);
+        if (!q.inbox.is_empty()) return true;
+        if (reservedBy[core_id] != nullptr) {
+            return !q.is_empty();
+        }
+        for (uint32_t i=0; i<kConfig.totalProcs; i++) {
+            if (!readyQ.forCPU(i).is_empty()) return true;
+        }
+        return false;
+    }
+
+    // We get here with nothing to run. Let the others know we're free,
+    // stop our tick and wait for somebody to put work in our queue.
+    //
+    // mwait wakes up when our inbox is written to. QEMU turns mwait into
+    // a pause when there is more than one core so there we hlt and
+    // schedule() follows up with an IPI.
+    void idle(uint32_t core_id) {
+        auto bit = uint32_t(1) << core_id;
+        auto& q = readyQ.forCPU(core_id);
+
+        cli();
+        idleCores.fetch_or(bit);
+        if (!anything_ready(core_id)) {
+            Pit::stopTick();
+            q.inbox.monitor_add();
+            if (q.inbox.is_empty() && q.is_empty()) {
+                if (onHypervisor) {
+                    sti_hlt();
+                } else {
+                    sti_mwait();
+                }
+                cli();
+            }
+            Pit::startTick();
+        }
+        idleCores.fetch_and(~bit);
+        sti();
+    }
+
     void schedule(TCB* tcb) {
         if (!tcb->isIdle) {
-            readyQ.add(tcb);
+            // count it before it is visible so the count never goes negative
+            if (tcb->priority == Priority::RealTime) {
+                realTimeReady.add_fetch(1);
+            }
+            // Give it to an idle core if there is one, otherwise keep it
+            // if we're allowed to. Going to a stale core (we migrated after
+            // reading the id, or the idle core found something else to do)
+            // is harmless, somebody will steal it. threadsInit gets here
+            // (the reaper) before SMP::init.
+            auto me = SMP::meEarly();
+            auto mine = uint32_t(1) << me;
+            auto cores = allowedCores(tcb);
+            auto idlers = idleCores.get() & cores & ~mine;
+            uint32_t target;
+            if (idlers != 0) {
+                target = __builtin_ctz(idlers);
+            } else if ((cores & mine) != 0) {
+                target = me;
+            } else {
+                target = __builtin_ctz(cores);
+            }
+            if (target == me) {
+                readyQ.forCPU(target).add(tcb);
+            } else {
+                readyQ.forCPU(target).inbox.add(tcb);
+            }
+
+            // It could have gone idle after we looked. Either it sees the
+            // new entry or we see its bit.
+            if ((target != me) && onHypervisor) {
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
+                if ((idleCores.get() & (uint32_t(1) << target)) != 0) {
+                    SMP::wakeup(target);
+                }
+            }
+        }
+    }
+
+    // A free list of same-sized blocks, linked through their first word
+    struct FreeList {
+        void* first = nullptr;
+        uint32_t count = 0;
+
+        void* pop() {
+            auto it = first;
+            if (it != nullptr) {
+                first = *((void**) it);
+                count --;
+            }
+            return it;
+        }
+
+        bool push(void* p, uint32_t max) {
+            if (count >= max) return false;
+            *((void**) p) = first;
+            first = p;
+            count ++;
+            return true;
+        }
+    };
+
+    // Each core only touches its own lists and only with interrupts
+    // disabled, so there is no lock. A block freed on another core than
+    // the one it came from just changes hands.
+    struct alignas(64) Pools {
+        FreeList tcbs;
+        FreeList stacks;
+    };
+
+    static PerCPU<Pools> pools{};
+
+    constexpr uint32_t TCB_SLOT_BYTES = 128;
+    constexpr uint32_t POOL_MAX = 32;       // per core, the rest go back to the heap
+
+    template <typename Alloc>
+    static void* pooled(FreeList Pools::* list, Alloc alloc) {
+        void* it;
+        Interrupts::protect([&it, list] {
+            it = (pools.forCPU(SMP::meEarly()).*list).pop();
+        });
+        return (it == nullptr) ? alloc() : it;
+    }
+
+    static bool recycle(FreeList Pools::* list, void* p) {
+        bool kept;
+        Interrupts::protect([&kept, list, p] {
+            kept = (pools.forCPU(SMP::meEarly()).*list).push(p, POOL_MAX);
+        });
+        return kept;
+    }
+
+    void* TCB::operator new(size_t size) {
+        if (size > TCB_SLOT_BYTES) return ::operator new(size);
+        return pooled(&Pools::tcbs, [] { return ::operator new(TCB_SLOT_BYTES); });
+    }
+
+    void TCB::operator delete(void* p, size_t size) {
+        if ((size > TCB_SLOT_BYTES) || !recycle(&Pools::tcbs, p)) {
+            ::operator delete(p);
+        }
+    }
+
+    uint32_t* allocStack() {
+        return (uint32_t*) pooled(&Pools::stacks, [] { return (void*) new uint32_t[STACK_WORDS]; });
+    }
+
+    void freeStack(uint32_t* stack) {
+        if (!recycle(&Pools::stacks, stack)) {
+            delete[] stack;
         }
     }
 
@@ -51,11 +313,17 @@ namespace gheith {
         }
     };
 
-    TCB::TCB(bool isIdle) : isIdle(isIdle), id(next_id.fetch_add(1)) {
+    TCB::TCB(bool isIdle) :
+        isIdle(isIdle),
+        id(next_id.fetch_add(1)),
+        priority(isIdle ? Priority::Low : Priority::Normal),
+        affinity(~uint32_t(0))
+    {
         saveArea.tcb = this;
     }
 
     TCB::~TCB() {
+        delete scratch;
     }
 };
 
@@ -70,8 +338,14 @@ void threadsInit() {
         activeThreads[i] = idleThreads[i];
     }
 
+#ifdef LOCK_STATS
+    for (unsigned i=0; i<kConfig.totalProcs; i++) {
+        readyQ.forCPU(i).track(new LockStats("readyQ",i));
+    }
+#endif
+
     // The reaper
-    thread([] {
+    thread(Priority::Low, [] {
         while (true) {
             ASSERT(!Interrupts::isDisabled());
             delete_zombies();
@@ -88,9 +362,128 @@ void yield() {
     });
 }
 
+void yieldToAll() {
+    using namespace gheith;
+    // MustBlock picks from every priority, we go back on the ready
+    // queue once we're off the core
+    block(BlockOption::MustBlock,[](TCB* me) {
+        schedule(me);
+    });
+}
+
+void setPriority(uint32_t priority) {
+    using namespace gheith;
+    ASSERT(priority < Priority::COUNT);
+    Interrupts::protect([priority] {
+        activeThreads[SMP::me()]->priority = priority;
+    });
+}
+
+SchedStats schedStats(uint32_t core) {
+    using namespace gheith;
+    ASSERT(core < kConfig.totalProcs);
+    return coreStats.forCPU(core).s;
+}
+
+uint64_t threadCycles() {
+    using namespace gheith;
+    uint64_t out;
+    Interrupts::protect([&out] {
+        auto core = SMP::me();
+        auto start = coreStats.forCPU(core).sliceStart;
+        out = activeThreads[core]->cycles + ((start == 0) ? 0 : rdtsc() - start);
+    });
+    return out;
+}
+
+// a*100/b without 64-bit division
+static uint32_t percent(uint64_t a, uint64_t b) {
+    while ((b >> 24) != 0) {
+        a >>= 1;
+        b >>= 1;
+    }
+    return (b == 0) ? 0 : uint32_t(a) * 100 / uint32_t(b);
+}
+
+void dumpSchedStats() {
+    Debug::printf("| sched: core switches preemptions busy%% avgQueue maxQueue\n");
+    for (uint32_t i=0; i<kConfig.totalProcs; i++) {
+        auto s = schedStats(i);
+        auto avg100 = (s.queueSamples == 0) ? 0 : s.queueTotal * 100 / s.queueSamples;
+        Debug::printf("| sched: %d %u %u %u %d.%02d %u\n",
+            i, s.switches, s.preemptions,
+            percent(s.busyCycles, s.busyCycles + s.idleCycles),
+            avg100 / 100, avg100 % 100, s.queueMax);
+    }
+}
+
+namespace gheith {
+    // Off this core and back through schedule(), which picks a core we
+    // are allowed on
+    static void migrate() {
+        block(BlockOption::MustBlock,[](TCB* me) {
+            schedule(me);
+        });
+    }
+
+    static bool allowedHere(TCB* tcb) {
+        bool out;
+        Interrupts::protect([tcb, &out] {
+            out = ((allowedCores(tcb) >> SMP::me()) & 1) != 0;
+        });
+        return out;
+    }
+}
+
+void setAffinity(uint32_t mask) {
+    using namespace gheith;
+    ASSERT((mask & allCores()) != 0);
+    auto me = current();
+    me->affinity = mask;
+    if (!allowedHere(me)) migrate();
+}
+
+bool reserveCore(uint32_t core) {
+    using namespace gheith;
+    if (core >= kConfig.totalProcs) return false;
+
+    auto me = current();
+    auto bit = uint32_t(1) << core;
+    {
+        LockGuard g{reserveLock};
+        if (reservedBy[core] != nullptr) return false;
+        if ((allCores() & ~reserved.get() & ~bit) == 0) return false;
+        for (uint32_t i=0; i<kConfig.totalProcs; i++) {
+            if (reservedBy[i] == me) return false;
+        }
+        reservedBy[core] = me;
+        reserved.fetch_or(bit);
+    }
+
+    setPriority(Priority::RealTime);
+    me->affinity = bit;
+    if (!allowedHere(me)) migrate();
+    return true;
+}
+
+void releaseCore() {
+    using namespace gheith;
+    auto me = current();
+    LockGuard g{reserveLock};
+    for (uint32_t i=0; i<kConfig.totalProcs; i++) {
+        if (reservedBy[i] == me) {
+            reservedBy[i] = nullptr;
+            reserved.fetch_and(~(uint32_t(1) << i));
+            me->affinity = ~uint32_t(0);
+        }
+    }
+}
+
 void stop() {
     using namespace gheith;
 
+    if (reserved.get() != 0) releaseCore();
+
     while(true) {
         block(BlockOption::MustBlock,[](TCB* me) {
             if (!me->isIdle) {
@@ -3,15 +3,36 @@
 
 #include "atomic.h"
 #include "queue.h"
+#include "lockfree.h"
 #include "heap.h"
 #include "debug.h"
 #include "smp.h"
 
+// Scheduling priorities, higher runs first. A thread that yields only
+// gives the core to threads of the same or higher priority, and a ready
+// RealTime thread is picked before anything else on any core. Since every
+// tick yields, that bounds how long a RealTime thread waits to one tick
+// no matter how many lower priority threads are around.
+namespace Priority {
+    constexpr uint32_t Low = 0;
+    constexpr uint32_t Normal = 1;
+    constexpr uint32_t High = 2;
+    constexpr uint32_t RealTime = 3;
+    constexpr uint32_t COUNT = 4;
+}
+
+class Arena;
+
 namespace gheith {
 
     constexpr static int STACK_BYTES = 8 * 1024;
     constexpr static int STACK_WORDS = STACK_BYTES / sizeof(uint32_t);
 
+    // The FXSAVE area lives at the top of the stack, 512 bytes plus
+    // whatever it takes to align it on 16
+    constexpr static int FPU_WORDS = (512 + 16) / sizeof(uint32_t);
+    constexpr static uint32_t NO_CORE = ~uint32_t(0);
+
     struct TCB;
 
     struct SaveArea {
@@ -31,6 +52,17 @@ namespace gheith {
 
         const bool isIdle;
         const uint32_t id;
+        volatile uint32_t priority;
+        volatile uint32_t affinity;     // bit i set -> may run on core i
+        uint64_t cycles = 0;            // TSC cycles spent on a core so far
+
+        // FPU/SSE state, see fpu.h. fpu is nullptr for threads that can't
+        // use the FPU (idle), fpuCore is the core whose registers might
+        // still hold our state
+        void* fpu = nullptr;
+        volatile uint32_t fpuCore = NO_CORE;
+
+        Arena* scratch = nullptr;       // see scratchArena(), made on first use
 
         // queue stuff
         TCB* next;
@@ -42,6 +74,12 @@ namespace gheith {
 
         virtual ~TCB();
 
+        // Most closures only capture a few words. TCBs that fit in a pool
+        // slot are recycled through per-core free lists, bigger ones come
+        // from the heap.
+        static void* operator new(size_t size);
+        static void operator delete(void* p, size_t size);
+
         virtual void doYourThing() = 0;
     };
 
@@ -50,8 +88,33 @@ namespace gheith {
     extern TCB** activeThreads;
     extern TCB** idleThreads;
 
+    // Every core owns a ready queue. Threads become runnable on the core
+    // that schedules them and cores that run out of work steal from the
+    // others. The alignment keeps two cores from sharing a cache line.
+    //
+    // Threads that another core hands us go through the lock-free inbox,
+    // so a cross-core wakeup doesn't wait for our lock. Only the owner
+    // empties it, into the queue proper, where thieves can see them.
+    struct alignas(64) ReadyQueue : public PriorityQueue<TCB,InterruptSafeTicketLock,Priority::COUNT> {
+        MPSCQueue<TCB> inbox;
+
+        void drain() {
+            while (true) {
+                auto it = inbox.remove();
+                if (it == nullptr) return;
+                add(it);
+            }
+        }
+    };
+
     extern TCB* current();
-    extern Queue<TCB,InterruptSafeLock> readyQ;
+    extern PerCPU<ReadyQueue> readyQ;
+    extern Atomic<uint32_t> realTimeReady;
+    extern TCB* next_ready(uint32_t core_id, uint32_t min);
+    extern void idle(uint32_t core_id);
+    extern void account(uint32_t core_id, TCB* me);
+    extern void fpuSwitch(uint32_t core_id, TCB* me);
+    extern void sampleTick(uint32_t core_id, bool preempting);
     extern void entry();
     extern void schedule(TCB*);
     extern void delete_zombies();
@@ -86,10 +149,13 @@ namespace gheith {
             me = activeThreads[core_id];
             me->saveArea.no_preempt = 1;
         });
+
+        // If we can return we're still runnable and should only make
+        // way for threads that are at least as important
+        auto min = (blockOption == BlockOption::CanReturn) ? me->priority : Priority::Low;
         
     again:
-        readyQ.monitor_add();
-        auto next_tcb = readyQ.remove();
+        auto next_tcb = next_ready(core_id, min);
         if (next_tcb == nullptr) {
             if (blockOption == BlockOption::CanReturn) return;
             if (me->isIdle) {
@@ -98,7 +164,7 @@ namespace gheith {
                 ASSERT(!Interrupts::isDisabled());
                 ASSERT(me == idleThreads[core_id]);
                 ASSERT(me == activeThreads[core_id]);
-                iAmStuckInALoop(true);
+                idle(core_id);
                 goto again;
             }
             next_tcb = idleThreads[core_id];    
@@ -106,24 +172,33 @@ namespace gheith {
 
         next_tcb->saveArea.no_preempt = 1;
 
+        account(core_id, me);
+        fpuSwitch(core_id, me);
+
         activeThreads[core_id] = next_tcb;  // Why is this safe?
 
         gheith_contextSwitch(&me->saveArea,&next_tcb->saveArea,(void *)caller<F>,(void*)&f);
     }
 
+    // Stacks are recycled the same way
+    extern uint32_t* allocStack();
+    extern void freeStack(uint32_t* stack);
+
     struct TCBWithStack : public TCB {
-        uint32_t *stack = new uint32_t[STACK_WORDS];
+        uint32_t *stack = allocStack();
     
         TCBWithStack() : TCB(false) {
-            stack[STACK_WORDS - 2] = 0x200;  // EFLAGS: IF
-            stack[STACK_WORDS - 1] = (uint32_t) entry;
+            constexpr int top = STACK_WORDS - FPU_WORDS;
+            fpu = (void*) ((uintptr_t(&stack[top]) + 15) & ~uintptr_t(15));
+            stack[top - 2] = 0x200;  // EFLAGS: IF
+            stack[top - 1] = (uint32_t) entry;
 	        saveArea.no_preempt = 0;
-            saveArea.esp = (uint32_t) &stack[STACK_WORDS-2];
+            saveArea.esp = (uint32_t) &stack[top-2];
         }
 
         ~TCBWithStack() {
             if (stack) {
-                delete[] stack;
+                freeStack(stack);
                 stack = nullptr;
             }
         }
@@ -150,9 +225,47 @@ namespace gheith {
 
 extern void threadsInit();
 
+// What a core has been up to. Times are in TSC cycles and only cover
+// finished time slices, the one that is running now isn't in yet.
+struct SchedStats {
+    uint32_t switches;          // context switches
+    uint32_t preemptions;       // ticks that made the running thread yield
+    uint64_t busyCycles;        // running threads
+    uint64_t idleCycles;        // running the idle thread
+    uint32_t queueSamples;      // ready queue length, sampled every tick
+    uint32_t queueTotal;
+    uint32_t queueMax;
+};
+
+extern SchedStats schedStats(uint32_t core);
+extern void dumpSchedStats();
+
+// cycles the calling thread has been on a core, the current slice included
+extern uint64_t threadCycles();
+
 extern void stop();
 extern void yield();
 
+// Like yield() but lower priority threads get to go first too. For
+// waiting on something a less important thread holds, which yield()
+// would never let run again if it was preempted on this core.
+extern void yieldToAll();
+
+// Changes the priority of the calling thread
+extern void setPriority(uint32_t priority);
+
+// Restricts the calling thread to the cores in mask (bit i -> core i)
+// and moves it if it's on the wrong one. Threads start out with all bits
+// set.
+extern void setAffinity(uint32_t mask);
+
+// Gives the calling thread a core of its own: it becomes RealTime, moves
+// there and nothing else runs on that core until it calls releaseCore()
+// or stops. Fails if the core is taken, if it is the last one left for
+// everybody else or if we already own one.
+extern bool reserveCore(uint32_t core);
+extern void releaseCore();
+
 
 template <typename T>
 void thread(T work) {
@@ -165,6 +278,17 @@ void thread(T work) {
 
 }
 
+template <typename T>
+void thread(uint32_t priority, T work) {
+    using namespace gheith;
+
+    delete_zombies();
+
+    auto tcb = new TCBImpl<T>(work);
+    tcb->priority = priority;
+    schedule(tcb);
+}
+
 
 
 #endif
@@ -0,0 +1,212 @@
+#include "timer.h"
+#include "debug.h"
+#include "machine.h"
+#include "threads.h"
+#include "pit.h"
+
+namespace gheith {
+
+    constexpr uint32_t IDLE = 0;
+    constexpr uint32_t ARMED = 1;
+    constexpr uint32_t FIRING = 2;
+    constexpr uint32_t CANCELLING = 3;      // FIRING, and arm() is a no-op until it's done
+
+    constexpr uint32_t LEVELS = 4;
+    constexpr uint32_t BITS = 8;
+    constexpr uint32_t SLOTS = 1 << BITS;
+    constexpr uint32_t MASK = SLOTS - 1;
+
+    static Timer* wheel[LEVELS][SLOTS];
+
+    // the last jiffy we processed
+    static uint32_t wheelNow = 0;
+
+    static InterruptSafeLock wheelLock{};
+
+    static inline Timer*& slot(uint32_t level, uint32_t jiffy) {
+        return wheel[level][(jiffy >> (level * BITS)) & MASK];
+    }
+
+    static void link(Timer* t, Timer*& head) {
+        t->prev = nullptr;
+        t->next = head;
+        if (head != nullptr) head->prev = t;
+        head = t;
+    }
+
+    static void unlink(Timer* t) {
+        if (t->next != nullptr) t->next->prev = t->prev;
+        if (t->prev != nullptr) {
+            t->prev->next = t->next;
+        } else {
+            // we're at the head of whatever slot we're in
+            for (uint32_t level=0; level<LEVELS; level++) {
+                auto& head = slot(level,t->expires);
+                if (head == t) {
+                    head = t->next;
+                    break;
+                }
+            }
+        }
+        t->next = nullptr;
+        t->prev = nullptr;
+    }
+
+    // Pick the lowest level whose slot is at or after "base" in every
+    // higher bit. Relative to base, that is the level that will get
+    // cascaded (or fired) just in time.
+    static void place(Timer* t, uint32_t base) {
+        uint32_t level = 0;
+        uint32_t diff = t->expires ^ base;
+        while ((level < LEVELS - 1) && ((diff >> ((level + 1) * BITS)) != 0)) {
+            level ++;
+        }
+        link(t,slot(level,t->expires));
+    }
+
+    static void cascade(uint32_t level, uint32_t now) {
+        auto& head = slot(level,now);
+        auto it = head;
+        head = nullptr;
+        while (it != nullptr) {
+            auto next = it->next;
+            place(it,now);
+            it = next;
+        }
+    }
+}
+
+void TimerWheel::arm(Timer* t, uint32_t jiffy) {
+    using namespace gheith;
+    LockGuard g{wheelLock};
+
+    ASSERT(t->state != ARMED);
+
+    // expired() re-arming itself while somebody cancels it
+    if (t->state == CANCELLING) return;
+
+    auto next = wheelNow + 1;
+    if (int32_t(jiffy - next) < 0) {
+        jiffy = next;
+    }
+    t->expires = jiffy;
+    t->state = ARMED;
+    place(t,next);
+}
+
+bool TimerWheel::cancel(Timer* t) {
+    using namespace gheith;
+    {
+        LockGuard g{wheelLock};
+        if (t->state == ARMED) {
+            unlink(t);
+            t->state = IDLE;
+            return true;
+        }
+        if (t->state == FIRING) {
+            // keeps expired() from arming it again on its way out
+            t->state = CANCELLING;
+        }
+    }
+    // the timekeeper could be in the middle of calling expired()
+    while (t->state == CANCELLING) {
+        pause();
+    }
+    return false;
+}
+
+void TimerWheel::tick(uint32_t now) {
+    using namespace gheith;
+    Timer* due;
+
+    {
+        LockGuard g{wheelLock};
+        wheelNow = now;
+
+        // cascade from the top so timers can fall more than one level
+        for (uint32_t level=LEVELS-1; level>0; level--) {
+            if ((now & ((1 << (level * BITS)) - 1)) == 0) {
+                cascade(level,now);
+            }
+        }
+
+        auto& head = slot(0,now);
+        due = head;
+        head = nullptr;
+        for (auto it = due; it != nullptr; it = it->next) {
+            it->state = FIRING;
+        }
+    }
+
+    // run them without holding the lock, they're allowed to arm timers
+    while (due != nullptr) {
+        auto next = due->next;
+        due->next = nullptr;
+        due->prev = nullptr;
+        due->expired();
+        // expired() is allowed to arm it again, unless it's being cancelled
+        if (due->state != ARMED) due->state = IDLE;
+        due = next;
+    }
+}
+
+bool TimerWheel::next(uint32_t& jiffy) {
+    using namespace gheith;
+    LockGuard g{wheelLock};
+
+    auto j = wheelNow + 1;
+
+    // a cascade that is due on the very next tick
+    for (uint32_t level=1; level<LEVELS; level++) {
+        if (((j & ((1 << (level * BITS)) - 1)) == 0) && (slot(level,j) != nullptr)) {
+            jiffy = j;
+            return true;
+        }
+    }
+
+    // Lower levels always expire before higher ones. On each level we
+    // look at the slots left until the level above wraps around.
+    for (uint32_t level=0; level<LEVELS; level++) {
+        auto shift = level * BITS;
+        for (uint32_t i=0; i<SLOTS; i++) {
+            if (slot(level,j) != nullptr) {
+                jiffy = j;
+                return true;
+            }
+            j += 1 << shift;
+            if ((level < LEVELS - 1) && (((j >> shift) & MASK) == 0)) break;
+        }
+    }
+    return false;
+}
+
+namespace gheith {
+    struct SleepTimer : public Timer {
+        TCB* tcb = nullptr;
+        void expired() override {
+            schedule(tcb);
+        }
+    };
+}
+
+void sleep_until(uint32_t jiffy) {
+    using namespace gheith;
+
+    if (int32_t(jiffy - Pit::jiffies) <= 0) return;
+
+    SleepTimer timer{};
+
+    // Arm the timer once we're off the core, it can't wake us up
+    // before we're asleep
+    block(BlockOption::MustBlock,[&timer,jiffy](TCB* me) {
+        ASSERT(!me->isIdle);
+        timer.tcb = me;
+        TimerWheel::arm(&timer,jiffy);
+    });
+
+    TimerWheel::cancel(&timer);
+}
+
+void sleep_ms(uint32_t ms) {
+    sleep_until(Pit::jiffies + Pit::msToJiffies(ms));
+}
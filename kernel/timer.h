@@ -0,0 +1,55 @@
+#ifndef _timer_h_
+#define _timer_h_
+
+#include "stdint.h"
+#include "atomic.h"
+
+// Something that needs to happen at a given jiffy. Timers are intrusive
+// (the wheel links them through next/prev) so arming one never allocates
+// and a Timer can live on the stack of the thread waiting for it.
+//
+// expired() runs on the timekeeping core, from the APIT interrupt or
+// from a core leaving idle, with interrupts disabled. Be quick and don't
+// block.
+//
+// The owner has to call TimerWheel::cancel before the Timer goes away,
+// even if it already fired. That is how we know expired() is done with it.
+class Timer {
+public:
+    Timer* next = nullptr;
+    Timer* prev = nullptr;
+    uint32_t expires = 0;
+    volatile uint32_t state = 0;
+
+    virtual void expired() = 0;
+};
+
+// A hierarchical timer wheel: 4 levels of 256 slots. Level 0 holds the
+// timers for the next 256 jiffies, one slot per jiffy. Each higher level
+// covers 256 times as much time and is cascaded into the lower ones as
+// the clock gets close. Arming, cancelling and most ticks are O(1).
+class TimerWheel {
+public:
+    // fire at the given jiffy, or on the next tick if that is in the past
+    static void arm(Timer* t, uint32_t jiffy);
+
+    // Returns true if the timer was taken out before it fired. Either way
+    // expired() isn't running once this returns and the timer isn't
+    // armed: if it was firing, an arm() from its own expired() is dropped.
+    static bool cancel(Timer* t);
+
+    // called by the timekeeping core for every jiffy (see Pit)
+    static void tick(uint32_t now);
+
+    // The first jiffy at which tick() has something to do, false if no
+    // timer is armed. For timers on the higher levels that is when they
+    // get cascaded, which can be earlier than when they expire.
+    static bool next(uint32_t& jiffy);
+};
+
+// Put the calling thread to sleep. Sleeping threads are off the ready
+// queues and don't use the CPU.
+extern void sleep_until(uint32_t jiffy);
+extern void sleep_ms(uint32_t ms);
+
+#endif
@@ -1,4 +1,6 @@
 #include "vga.h"
+#include "timer.h"
+#include "arena.h"
 
 static uint8_t* vga_buf = (uint8_t*) 0xA0000;
 
@@ -58,17 +60,16 @@ bool VGA::setPortsGraphics(unsigned char* g_90x60_text) {
     return true;
 }
 
-void wait(int unit, Shared<Node> item) {
-    for (int i = 0; i < unit; i++)  {
-        char* pix = item->read_bmp();
-        delete[] pix;
-    }
+// Used to burn time by decoding a bmp "unit" times, about 100us each.
+// Sleep for that long instead.
+void wait(int unit) {
+    sleep_ms((unit + 9) / 10);
 }
 
 void VGA::shut_off() {
     initializeScreen(bg_color);
     drawString(90, 100, "System Turned OFF", 63);
-    wait(50, curr->small);
+    wait(50);
     Debug::shutdown();
 }
 
@@ -83,24 +84,24 @@ void VGA::bootup(Shared<Node> logo) {
     drawRectangle(12, 102, 32, 108, 45, true);
     const int wait_time = 60;
     for (int i = 0; i < 80; i ++) {
-        wait(wait_time, logo);
+        wait(wait_time);
     }
     for (int i = 32; i < 108; i ++) {
-        wait(10, logo);
+        wait(10);
         drawRectangle(12, 102, i, 108, 45, true);
     }
     for (int i = 0; i < 60; i ++) {
-        wait(wait_time, logo);
+        wait(wait_time);
     }
     for (int i = 108; i < 208; i ++) {
-        wait(10, logo);
+        wait(10);
         drawRectangle(12, 102, i, 108, 45, true);
     }
     for (int i = 0; i < 70; i ++) {
-        wait(wait_time, logo);
+        wait(wait_time);
     }
     for (int i = 208; i < 308; i ++) {
-        wait(10, logo);
+        wait(10);
         drawRectangle(12, 102, i, 108, 45, true);
     }
 }
@@ -175,7 +176,8 @@ void VGA::playingSong(uint32_t percentage) {
             elapsed_time.add_fetch(1);
             uint32_t min = elapsed_time.get() / 60;
             uint32_t sec = elapsed_time.get() % 60;
-            char* str = new char[5];
+            ArenaScope scratch;
+            char* str = scratch.alloc<char>(5);
             drawRectangle(75, 136, 108, 144, bg_color, true);
             str[0] = (char) (min + ((uint8_t) '0'));
             str[1] = ':';
@@ -183,7 +185,6 @@ void VGA::playingSong(uint32_t percentage) {
             str[3] = (char) (sec % 10 + ((uint8_t) '0'));
             str[4] = '\0';
             drawString(75, 136, (const char*) str, 63);
-            delete[] str;
         }
     }
 }
@@ -402,7 +403,7 @@ void VGA::place_bmp(uint32_t x, uint32_t ending_y, uint32_t pic_width, uint32_t
     }
 }
 
-void VGA::spotify_move(Shared<File_Node> song, bool willPlay, bool skip) {
+void VGA::spotify_move(Borrowed<File_Node> song, bool willPlay, bool skip) {
     drawString(24, 65, (const char*) "PREV", 63);
     drawString(264, 65, (const char*) "NEXT", 63);
     playing = 0;
@@ -438,10 +439,10 @@ void VGA::spotify_move(Shared<File_Node> song, bool willPlay, bool skip) {
     play_pause();
 }
 
-void VGA::spotify(Shared<File_Node> song, bool willPlay) {
+void VGA::spotify(Borrowed<File_Node> song, bool willPlay) {
     drawString(24, 65, (const char*) "PREV", 63);
     drawString(264, 65, (const char*) "NEXT", 63);
-    curr = song;
+    curr = song.share();
     playing = 0;
     int l = K::strlen(song->file_name);
     drawLine(110, 140, 210, 140, 63);
@@ -455,14 +456,14 @@ void VGA::spotify(Shared<File_Node> song, bool willPlay) {
 
     
     // center album
-    Shared<Node> centerpiece = song->big;
+    Borrowed<Node> centerpiece = song->big;
     char* pixels = centerpiece->read_bmp();
     uint32_t starting_x = width/2 - 35;
     uint32_t starting_y = length/3 + 35;
     place_bmp(starting_x, starting_y, 70, 70, pixels);
     delete[] pixels;
      
-    Shared<Node> left_small = song->prev->small;
+    Borrowed<Node> left_small = song->prev->small;
     // upcoming album
     if (K::streq(song->prev->file_name, "")) {
         left_small = song->prev->prev->small;
@@ -474,7 +475,7 @@ void VGA::spotify(Shared<File_Node> song, bool willPlay) {
     delete[] left_p;
 
     // last played album
-    Shared<Node> right_small = song->next->small;
+    Borrowed<Node> right_small = song->next->small;
     if (K::streq(song->next->file_name, "")) {
         right_small = song->next->next->small;
     }
@@ -528,9 +529,9 @@ void VGA::drawPauseCircle(uint32_t c_x, uint32_t c_y, uint32_t r, uint8_t color)
     }
 }
 
-void VGA::moveOutPic(Shared<File_Node> fn, bool skip) {
-    Shared<File_Node> prev_n = fn->prev;
-    Shared<File_Node> next_n = fn->next;
+void VGA::moveOutPic(Borrowed<File_Node> fn, bool skip) {
+    Borrowed<File_Node> prev_n = fn->prev;
+    Borrowed<File_Node> next_n = fn->next;
     if (K::streq(prev_n->file_name, "")) {
         prev_n = prev_n->prev;
     }
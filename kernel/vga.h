@@ -264,11 +264,11 @@ class VGA {
     // given a file node and whether it is playing, it initializes the gui setup
     // of the prev, current, and next song. The main function to call everytime 
     // a new song is playing
-    void spotify(Shared<File_Node> song, bool willPlay);
+    void spotify(Borrowed<File_Node> song, bool willPlay);
 
     // a version of spotify that gets called when an arrow key is clicked in order to 
     // set an animation
-    void spotify_move(Shared<File_Node> song, bool willPlay, bool skip);
+    void spotify_move(Borrowed<File_Node> song, bool willPlay, bool skip);
 
     // flips whether the song is in play mode or pause mode on the graphics side
     void play_pause();
@@ -283,7 +283,7 @@ class VGA {
     void place_bmp(uint32_t x, uint32_t ending_y, uint32_t pic_width, uint32_t pic_length, char* rgb_buf);
 
     // moves the bmps in an animation style when the left or right arrow keys are clicked
-    void moveOutPic(Shared<File_Node> fn, bool skip);
+    void moveOutPic(Borrowed<File_Node> fn, bool skip);
 
     // the buffer that lets drawChar choose whether to color a pixel for a row or not
     uint8_t vga_font[128][8] = {
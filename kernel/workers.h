@@ -0,0 +1,79 @@
+#ifndef _workers_h_
+#define _workers_h_
+
+#include "stdint.h"
+#include "atomic.h"
+#include "queue.h"
+#include "semaphore.h"
+#include "threads.h"
+#include "heap.h"
+
+// A fixed set of threads that run short jobs. Jobs are closures copied
+// into slots that are allocated once, up front, so submitting one
+// neither allocates nor creates a thread. submit() blocks while all the
+// slots are in use. Pools live forever, create them once at startup.
+//
+//    auto pool = new WorkerPool(kConfig.totalProcs, 32);
+//    pool->submit([wave, chunk] { wave->analyze(chunk); });
+//
+class WorkerPool {
+public:
+    static constexpr uint32_t JOB_BYTES = 64;
+
+private:
+    struct Job {
+        Job* next = nullptr;
+        void (*run)(void* closure) = nullptr;
+        uint32_t closure[JOB_BYTES / sizeof(uint32_t)];
+    };
+
+    Job* const jobs;
+    Queue<Job,InterruptSafeLock> spare;
+    Queue<Job,InterruptSafeLock> pending;
+    Semaphore nSpare;
+    Semaphore nPending;
+
+    template <typename F>
+    static void call(void* closure) {
+        auto f = (F*) closure;
+        (*f)();
+        f->~F();
+    }
+
+public:
+    WorkerPool(uint32_t nThreads, uint32_t nJobs) :
+        jobs(new Job[nJobs]), spare(), pending(), nSpare(nJobs), nPending(0)
+    {
+        for (uint32_t i=0; i<nJobs; i++) {
+            spare.add(&jobs[i]);
+        }
+        for (uint32_t i=0; i<nThreads; i++) {
+            thread([this] {
+                while (true) {
+                    nPending.down();
+                    auto job = pending.remove();
+                    job->run(job->closure);
+                    spare.add(job);
+                    nSpare.up();
+                }
+            });
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+
+    template <typename F>
+    void submit(F work) {
+        static_assert(sizeof(F) <= JOB_BYTES, "closure doesn't fit in a job slot");
+        static_assert(alignof(F) <= alignof(uint32_t), "closure is over-aligned for a job slot");
+
+        nSpare.down();
+        auto job = spare.remove();
+        new (job->closure) F(work);
+        job->run = call<F>;
+        pending.add(job);
+        nPending.up();
+    }
+};
+
+#endif